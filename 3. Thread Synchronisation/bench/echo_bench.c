@@ -0,0 +1,122 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// Thread-per-connection echo server and clients over loopback, all on green
+// threads. Every recv that would block parks its thread in epoll instead of
+// blocking the kernel thread. Takes the number of connections and the number
+// of round trips per connection as optional arguments.
+
+#define DEFAULT_CONNECTIONS 60
+#define DEFAULT_ROUND_TRIPS 2000
+#define MESSAGE_SIZE 64
+
+struct sockaddr_in server_addr;
+int listen_fd;
+int round_trips = DEFAULT_ROUND_TRIPS;
+volatile int finished;
+
+double now_secs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Receive exactly len bytes
+int recv_all(int fd, char *buf, size_t len){
+	size_t got = 0;
+	while(got < len){
+		ssize_t n = recv(fd, buf + got, len - got, 0);
+		if(n <= 0){
+			return -1;
+		}
+		got += n;
+	}
+	return 0;
+}
+
+void* handler(void *arg){
+	int fd = (int)(intptr_t) arg;
+	char buf[MESSAGE_SIZE];
+
+	while(recv_all(fd, buf, sizeof(buf)) == 0){
+		send(fd, buf, sizeof(buf), 0);
+	}
+	close(fd);
+	return NULL;
+}
+
+void* server(void *arg){
+	int connections = (int)(intptr_t) arg;
+	pthread_t tid;
+
+	for(int i = 0; i < connections; i++){
+		int fd = accept(listen_fd, NULL, NULL);
+		if(fd < 0){
+			perror("accept");
+			exit(EXIT_FAILURE);
+		}
+		pthread_create(&tid, NULL, &handler, (void *)(intptr_t) fd);
+	}
+	return NULL;
+}
+
+void* client(void *arg){
+	char buf[MESSAGE_SIZE];
+	memset(buf, 'x', sizeof(buf));
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(connect(fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) != 0){
+		perror("connect");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < round_trips; i++){
+		send(fd, buf, sizeof(buf), 0);
+		if(recv_all(fd, buf, sizeof(buf)) != 0){
+			fprintf(stderr, "connection closed early\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+	__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int connections = (argc > 1) ? atoi(argv[1]) : DEFAULT_CONNECTIONS;
+	round_trips = (argc > 2) ? atoi(argv[2]) : DEFAULT_ROUND_TRIPS;
+	pthread_t tid;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server_addr.sin_port = 0;
+	socklen_t len = sizeof(server_addr);
+	if(bind(listen_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) != 0
+		|| listen(listen_fd, connections) != 0
+		|| getsockname(listen_fd, (struct sockaddr *) &server_addr, &len) != 0){
+		perror("listen");
+		return EXIT_FAILURE;
+	}
+
+	double start = now_secs();
+	pthread_create(&tid, NULL, &server, (void *)(intptr_t) connections);
+	for(int i = 0; i < connections; i++){
+		pthread_create(&tid, NULL, &client, NULL);
+	}
+	while(__atomic_load_n(&finished, __ATOMIC_SEQ_CST) < connections){
+		usleep(1000);
+	}
+	double secs = now_secs() - start;
+
+	long total = (long) connections * round_trips;
+	printf("%d connections, %d round trips of %d bytes each\n", connections, round_trips, MESSAGE_SIZE);
+	printf("%.3f s, %.0f round trips/s, %.1f us per round trip\n", secs, total / secs, secs * 1e6 / total);
+	return 0;
+}
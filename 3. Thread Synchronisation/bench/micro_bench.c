@@ -0,0 +1,440 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// Microbenchmarks of the thread library, printed as JSON. The makefile links
+// this file against threads.o, and also builds it against glibc's pthreads as
+// micro_bench_glibc (BENCH_GLIBC) so that the two can be compared, with
+// swapcontext() standing in for fibers, a pthread_create() loop for
+// ec440_spawn_many(), and a one-slot queue under a mutex and a condition
+// variable for channels. Every measurement runs in a child process of its own, so
+// that none of them starts with the threads of another. A measurement that
+// crashes or takes longer than MEASURE_TIMEOUT_SECS is reported as null.
+
+#ifdef BENCH_GLIBC
+#include <ucontext.h>
+#define LIBRARY "glibc"
+#else
+#include "ec440.h"
+#define LIBRARY "ec440"
+#endif
+
+#define CREATE_CNT 100
+#define YIELD_ITERS 100000
+#define FIBER_ITERS 1000000
+#define FIBER_STACK_SIZE 32768
+#define MUTEX_ITERS 1000000
+#define CONTENDED_THREADS 4
+#define CONTENDED_ITERS 100000
+#define CONTENDED_YIELD_EVERY 8
+#define HANDOFF_ITERS 100000
+#define CHAN_ITERS 100000
+#define BARRIER_MAX_THREADS 128
+#define BARRIER_WAITS 4000
+#define MEMORY_THREADS 64
+#define MEASURE_TIMEOUT_SECS 10
+
+volatile int finished;
+volatile int turn;
+long counter;
+pthread_mutex_t mutex;
+pthread_barrier_t barrier;
+int barrier_rounds;
+
+double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Wait for count threads to bump finished
+void wait_finished(int count){
+	while(__atomic_load_n(&finished, __ATOMIC_SEQ_CST) < count){
+		sched_yield();
+	}
+}
+
+// Lock the mutex, and stop the measurement if that fails
+void mutex_lock(){
+	if(pthread_mutex_lock(&mutex) != 0){
+		exit(EXIT_FAILURE);
+	}
+}
+
+void* finish(void *arg){
+	__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+// Microseconds to create a thread and run it to the end
+double create_exit(int arg){
+	pthread_t tid;
+	double start = now_ns();
+
+	for(int i = 0; i < CREATE_CNT; i++){
+		pthread_create(&tid, NULL, &finish, NULL);
+	}
+	wait_finished(CREATE_CNT);
+	return (now_ns() - start) / CREATE_CNT / 1000;
+}
+
+// Microseconds per thread to create CREATE_CNT threads at once and run them to the end
+double spawn_exit(int arg){
+	pthread_t tids[CREATE_CNT];
+	double start = now_ns();
+
+#ifdef BENCH_GLIBC
+	for(int i = 0; i < CREATE_CNT; i++){
+		pthread_create(&tids[i], NULL, &finish, NULL);
+	}
+#else
+	ec440_spawn_many(CREATE_CNT, &finish, NULL, tids);
+#endif
+	wait_finished(CREATE_CNT);
+	return (now_ns() - start) / CREATE_CNT / 1000;
+}
+
+void* ping_pong(void *arg){
+	int self = (int)(intptr_t) arg;
+
+	for(int i = 0; i < YIELD_ITERS; i++){
+		while(turn != self){
+			sched_yield();
+		}
+		turn = !self;
+	}
+	return NULL;
+}
+
+// Nanoseconds per handoff between two threads that take turns with sched_yield()
+double yield_ping_pong(int arg){
+	pthread_t tid;
+	pthread_create(&tid, NULL, &ping_pong, (void *) 1);
+
+	double start = now_ns();
+	ping_pong((void *) 0);
+	return (now_ns() - start) / (2.0 * YIELD_ITERS);
+}
+
+#ifdef BENCH_GLIBC
+ucontext_t main_context, fiber_context;
+
+void fiber_loop(){
+	while(1){
+		swapcontext(&fiber_context, &main_context);
+	}
+}
+
+// Nanoseconds per switch between two contexts of the same thread, with swapcontext()
+double fiber_switch(int arg){
+	getcontext(&fiber_context);
+	fiber_context.uc_stack.ss_sp = malloc(FIBER_STACK_SIZE);
+	fiber_context.uc_stack.ss_size = FIBER_STACK_SIZE;
+	makecontext(&fiber_context, &fiber_loop, 0);
+
+	double start = now_ns();
+	for(int i = 0; i < FIBER_ITERS; i++){
+		swapcontext(&main_context, &fiber_context);
+	}
+	return (now_ns() - start) / (2.0 * FIBER_ITERS);
+}
+#else
+void* fiber_loop(void *arg){
+	while(1){
+		fiber_yield(NULL);
+	}
+	return NULL;
+}
+
+// Nanoseconds per switch between two contexts of the same thread, with fiber_resume() and fiber_yield()
+double fiber_switch(int arg){
+	fiber_t fiber;
+	fiber_create(&fiber, &fiber_loop, NULL);
+
+	double start = now_ns();
+	for(int i = 0; i < FIBER_ITERS; i++){
+		fiber_resume(fiber, NULL);
+	}
+	return (now_ns() - start) / (2.0 * FIBER_ITERS);
+}
+#endif
+
+// Nanoseconds per lock/unlock pair with nobody else around
+double mutex_uncontended(int arg){
+	pthread_t tid;
+
+	// Start the library up first, so that only the mutex is measured
+	pthread_create(&tid, NULL, &finish, NULL);
+	wait_finished(1);
+
+	double start = now_ns();
+	for(int i = 0; i < MUTEX_ITERS; i++){
+		mutex_lock();
+		counter++;
+		pthread_mutex_unlock(&mutex);
+	}
+	return (now_ns() - start) / MUTEX_ITERS;
+}
+
+void* hammer(void *arg){
+	for(int i = 0; i < CONTENDED_ITERS; i++){
+		mutex_lock();
+		counter++;
+		if(i % CONTENDED_YIELD_EVERY == 0){
+			sched_yield();
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+	__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+// Nanoseconds per lock/unlock pair with several threads hammering the same mutex. A thread
+// switch rarely lands inside the few instructions the mutex is held for, so every holder also
+// yields with the mutex locked now and then, and the other threads queue up behind it
+double mutex_contended(int arg){
+	pthread_t tid;
+	double start = now_ns();
+
+	for(int i = 0; i < CONTENDED_THREADS; i++){
+		pthread_create(&tid, NULL, &hammer, NULL);
+	}
+	wait_finished(CONTENDED_THREADS);
+	return (now_ns() - start) / (CONTENDED_THREADS * CONTENDED_ITERS);
+}
+
+void* hand_over(void *arg){
+	for(int i = 0; i < HANDOFF_ITERS; i++){
+		mutex_lock();
+		sched_yield();
+		pthread_mutex_unlock(&mutex);
+	}
+	__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+// Nanoseconds per lock/unlock pair when the other thread always waits for the mutex: each
+// holder yields with the mutex locked, so that every unlock has a waiter to hand over to
+double mutex_handoff(int arg){
+	pthread_t tid;
+	double start = now_ns();
+
+	for(int i = 0; i < 2; i++){
+		pthread_create(&tid, NULL, &hand_over, NULL);
+	}
+	wait_finished(2);
+	return (now_ns() - start) / (2 * HANDOFF_ITERS);
+}
+
+#ifdef BENCH_GLIBC
+// What our pipeline stages used before channels: a queue under a mutex, here with one slot
+typedef struct{
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	bool full;
+	int value;
+}chan_t;
+
+chan_t *chan_create(size_t capacity, size_t elem_size){
+	chan_t *chan = calloc(1, sizeof(chan_t));
+	pthread_mutex_init(&chan->mutex, NULL);
+	pthread_cond_init(&chan->changed, NULL);
+	return chan;
+}
+
+int chan_send(chan_t *chan, const void *elem){
+	pthread_mutex_lock(&chan->mutex);
+	while(chan->full){
+		pthread_cond_wait(&chan->changed, &chan->mutex);
+	}
+	chan->value = *(const int *) elem;
+	chan->full = true;
+	pthread_cond_broadcast(&chan->changed);
+	pthread_mutex_unlock(&chan->mutex);
+	return 0;
+}
+
+int chan_recv(chan_t *chan, void *elem){
+	pthread_mutex_lock(&chan->mutex);
+	while(!chan->full){
+		pthread_cond_wait(&chan->changed, &chan->mutex);
+	}
+	*(int *) elem = chan->value;
+	chan->full = false;
+	pthread_cond_broadcast(&chan->changed);
+	pthread_mutex_unlock(&chan->mutex);
+	return 0;
+}
+#endif
+
+chan_t *ping, *pong;
+
+void* chan_echo(void *arg){
+	int value;
+	for(int i = 0; i < CHAN_ITERS; i++){
+		chan_recv(ping, &value);
+		chan_send(pong, &value);
+	}
+	return NULL;
+}
+
+// Nanoseconds per message between two threads that bounce it back and forth over
+// unbuffered channels, so that every send finds the receiver already waiting
+double chan_ping_pong(int arg){
+	pthread_t tid;
+	ping = chan_create(0, sizeof(int));
+	pong = chan_create(0, sizeof(int));
+	pthread_create(&tid, NULL, &chan_echo, NULL);
+
+	double start = now_ns();
+	for(int i = 0; i < CHAN_ITERS; i++){
+		int value = i;
+		chan_send(ping, &value);
+		chan_recv(pong, &value);
+	}
+	return (now_ns() - start) / (2.0 * CHAN_ITERS);
+}
+
+void* barrier_loop(void *arg){
+	for(int i = 0; i < barrier_rounds; i++){
+		pthread_barrier_wait(&barrier);
+	}
+	return NULL;
+}
+
+// Microseconds for a round of threads threads, main included, through the barrier
+double barrier_round(int threads){
+	pthread_t tid;
+	barrier_rounds = BARRIER_WAITS / threads;
+	pthread_barrier_init(&barrier, NULL, threads);
+
+	double start = now_ns();
+	for(int i = 1; i < threads; i++){
+		pthread_create(&tid, NULL, &barrier_loop, NULL);
+	}
+	barrier_loop(NULL);
+	return (now_ns() - start) / barrier_rounds / 1000;
+}
+
+// A field of /proc/self/status, in kB
+long proc_status_kb(const char *field){
+	char line[256];
+	long kb = 0;
+	FILE *status = fopen("/proc/self/status", "r");
+
+	while(status != NULL && fgets(line, sizeof(line), status) != NULL){
+		if(strncmp(line, field, strlen(field)) == 0){
+			kb = strtol(line + strlen(field) + 1, NULL, 10);
+		}
+	}
+	if(status != NULL){
+		fclose(status);
+	}
+	return kb;
+}
+
+void* block(void *arg){
+	mutex_lock();
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+// kB per thread blocked on a mutex, resident (arg 0) or reserved address space (arg 1)
+double memory_per_thread(int virtual){
+	const char *field = virtual ? "VmSize:" : "VmRSS:";
+	pthread_t tid;
+
+	// Start the library up first, so that its own memory is not charged to the threads
+	pthread_create(&tid, NULL, &finish, NULL);
+	wait_finished(1);
+
+	mutex_lock();
+	long before = proc_status_kb(field);
+	for(int i = 0; i < MEMORY_THREADS; i++){
+		pthread_create(&tid, NULL, &block, NULL);
+	}
+	sched_yield();
+	long after = proc_status_kb(field);
+	pthread_mutex_unlock(&mutex);
+	return (double)(after - before) / MEMORY_THREADS;
+}
+
+// Run one measurement in a child process and return what it measured, or -1 if it failed
+double measure(double (*benchmark)(int), int arg){
+	int fds[2];
+	double result = -1;
+	struct pollfd pfd;
+
+	fflush(stdout);
+	if(pipe(fds) != 0){
+		return result;
+	}
+	pid_t pid = fork();
+	if(pid == 0){
+		result = benchmark(arg);
+		write(fds[1], &result, sizeof(result));
+		_exit(0);
+	}
+	close(fds[1]);
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, MEASURE_TIMEOUT_SECS * 1000) != 1 || read(fds[0], &result, sizeof(result)) != sizeof(result)){
+		kill(pid, SIGKILL);
+		result = -1;
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return result;
+}
+
+// Print a measurement as a JSON number, or null if it failed
+void print_result(const char *format, double result){
+	if(result < 0){
+		printf("null");
+	}
+	else{
+		printf(format, result);
+	}
+}
+
+int main(int argc, char **argv) {
+	pthread_mutex_init(&mutex, NULL);
+
+	printf("{\n");
+	printf("  \"library\": \"%s\",\n", LIBRARY);
+	printf("  \"create_exit_us\": ");
+	print_result("%.3f", measure(&create_exit, 0));
+	printf(",\n  \"spawn_exit_us\": ");
+	print_result("%.3f", measure(&spawn_exit, 0));
+	printf(",\n  \"yield_ping_pong_ns\": ");
+	print_result("%.1f", measure(&yield_ping_pong, 0));
+	printf(",\n  \"fiber_switch_ns\": ");
+	print_result("%.1f", measure(&fiber_switch, 0));
+	printf(",\n  \"mutex_uncontended_ns\": ");
+	print_result("%.1f", measure(&mutex_uncontended, 0));
+	printf(",\n  \"mutex_contended_ns\": ");
+	print_result("%.1f", measure(&mutex_contended, 0));
+	printf(",\n  \"mutex_handoff_ns\": ");
+	print_result("%.1f", measure(&mutex_handoff, 0));
+	printf(",\n  \"chan_ping_pong_ns\": ");
+	print_result("%.1f", measure(&chan_ping_pong, 0));
+	printf(",\n  \"barrier_round_us\": {");
+	for(int threads = 2; threads <= BARRIER_MAX_THREADS; threads *= 2){
+		printf("%s\"%d\": ", (threads == 2) ? "" : ", ", threads);
+		print_result("%.3f", measure(&barrier_round, threads));
+	}
+	printf("},\n  \"memory_per_thread_kb\": {\"resident\": ");
+	print_result("%.1f", measure(&memory_per_thread, 0));
+	printf(", \"virtual\": ");
+	print_result("%.1f", measure(&memory_per_thread, 1));
+	printf("}\n}\n");
+	return 0;
+}
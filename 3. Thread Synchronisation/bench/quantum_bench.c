@@ -0,0 +1,105 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "ec440.h"
+
+// Latency vs throughput across scheduling quanta. CPU-bound workers count
+// loop iterations (throughput) and record how long they are kept off the CPU
+// every time they get descheduled (latency).
+
+#define WORKER_CNT 4
+#define RUN_USECS (300 * 1000)
+#define WORK_CHUNK 1000
+#define GAP_THRESHOLD_USECS 200
+
+static const useconds_t quanta[] = {1000, 5000, 10000, 50000, 100000};
+#define QUANTA_CNT (sizeof(quanta) / sizeof(quanta[0]))
+
+volatile unsigned long work[WORKER_CNT];
+volatile int finished;
+long deadline;
+long gap_total, gap_max, gap_cnt;
+
+long now_usecs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void spin(int idx){
+	long last = now_usecs();
+	while(last < deadline){
+		for(int i = 0; i < WORK_CHUNK; i++){
+			work[idx]++;
+		}
+
+		// A long gap between two chunks means this thread was descheduled
+		long t = now_usecs();
+		if(t - last > GAP_THRESHOLD_USECS){
+			gap_total += t - last;
+			gap_cnt++;
+			if(t - last > gap_max){
+				gap_max = t - last;
+			}
+		}
+		last = t;
+	}
+}
+
+void* worker(void *arg){
+	spin((int)(intptr_t)arg);
+	finished++;
+	return NULL;
+}
+
+// Run one round and print its row. Main is worker 0
+void run(const char *label, unsigned long baseline){
+	pthread_t tid;
+
+	for(int i = 0; i < WORKER_CNT; i++){
+		work[i] = 0;
+	}
+	finished = 0;
+	gap_total = gap_max = gap_cnt = 0;
+	deadline = now_usecs() + RUN_USECS;
+
+	for(int i = 1; i < WORKER_CNT; i++){
+		pthread_create(&tid, NULL, &worker, (void *)(intptr_t)i);
+	}
+	spin(0);
+	while(finished < WORKER_CNT - 1){
+	}
+
+	unsigned long total = 0;
+	for(int i = 0; i < WORKER_CNT; i++){
+		total += work[i];
+	}
+	printf("%-10s %14.1f %11.1f%% %14.2f %14.2f\n", label,
+		(double)total / RUN_USECS, 100.0 * total / baseline,
+		gap_cnt ? (double)gap_total / gap_cnt / 1000 : 0.0, (double)gap_max / 1000);
+}
+
+int main(int argc, char **argv) {
+	char label[32];
+
+	// Calibrate with main alone, which runs tickless
+	work[0] = 0;
+	deadline = now_usecs() + RUN_USECS;
+	spin(0);
+	unsigned long baseline = work[0];
+
+	printf("%d CPU-bound threads, %d ms per run\n", WORKER_CNT, RUN_USECS / 1000);
+	printf("%-10s %14s %12s %14s %14s\n", "quantum", "iters/usec", "efficiency", "avg wait ms", "max wait ms");
+	for(int i = 0; i < QUANTA_CNT; i++){
+		ec440_set_quantum(quanta[i]);
+		snprintf(label, sizeof(label), "%u us", quanta[i]);
+		run(label, baseline);
+	}
+
+	ec440_set_quantum(50 * 1000);
+	ec440_set_adaptive_quantum(true);
+	run("adaptive", baseline);
+	return 0;
+}
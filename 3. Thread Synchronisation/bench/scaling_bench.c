@@ -0,0 +1,76 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// CPU-bound scaling across kernel workers (M:N mode). Without arguments it
+// re-runs itself with EC440_WORKERS=1..N, N being the number of online cores
+// unless given as the first argument, and reports the speedup of each run.
+
+#define THREAD_CNT 16
+#define WORK_ITERS (1L << 24)
+
+volatile int finished;
+
+double now_secs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void work(){
+	for(volatile long i = 0; i < WORK_ITERS; i++);
+	__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+}
+
+void* worker(void *arg){
+	work();
+	return NULL;
+}
+
+// One run with whatever EC440_WORKERS is set to. Main does a share of the work too
+int run(){
+	pthread_t tid;
+	double start = now_secs();
+
+	for(int i = 1; i < THREAD_CNT; i++){
+		pthread_create(&tid, NULL, &worker, NULL);
+	}
+	work();
+	while(__atomic_load_n(&finished, __ATOMIC_SEQ_CST) < THREAD_CNT){
+	}
+
+	printf("%f\n", now_secs() - start);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1 && strcmp(argv[1], "run") == 0){
+		return run();
+	}
+
+	long max_workers = (argc > 1) ? strtol(argv[1], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+	double baseline = 0;
+	char cmd[4096];
+
+	printf("%d CPU-bound threads, %ld iterations each\n", THREAD_CNT, WORK_ITERS);
+	printf("%-8s %12s %10s\n", "workers", "seconds", "speedup");
+	for(long workers = 1; workers <= max_workers; workers++){
+		snprintf(cmd, sizeof(cmd), "EC440_WORKERS=%ld '%s' run", workers, argv[0]);
+		FILE *child = popen(cmd, "r");
+		double secs = 0;
+		if(child == NULL || fscanf(child, "%lf", &secs) != 1){
+			fprintf(stderr, "Error, could not run %s\n", cmd);
+			exit(-1);
+		}
+		pclose(child);
+
+		if(workers == 1){
+			baseline = secs;
+		}
+		printf("%-8ld %12.3f %9.2fx\n", workers, secs, baseline / secs);
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+#ifndef __EC440__
+#define __EC440__
+
+/* Extensions to the pthread interface implemented by threads.c. Unlike
+ * ec440threads.h, this header can be included by programs using the library. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+//***************************************Scheduler***************************************//
+
+// Set the scheduling quantum in microseconds. Returns EINVAL if usecs is 0
+int ec440_set_quantum(useconds_t usecs);
+
+// Get the scheduling quantum in microseconds
+useconds_t ec440_get_quantum(void);
+
+// Let the scheduler shorten or stretch the quantum depending on the workload
+void ec440_set_adaptive_quantum(bool enabled);
+
+// Whether pthread_create() switches to the new thread right away (the default, unless
+// EC440_CREATE_YIELD=0). Without it the creator keeps its quantum
+void ec440_set_create_yield(bool enabled);
+
+// Create n threads running start_routine(args[i]), or start_routine(NULL) if args is NULL, and
+// store their IDs in tids. They all become ready at once, and the caller switches at most once.
+// Returns EAGAIN, creating none, if the thread table does not have n free slots
+int ec440_spawn_many(size_t n, void *(*start_routine) (void *), void **args, pthread_t *tids);
+
+//***************************************Wait and Wake***************************************//
+
+// Block until ec440_wake() on addr, if *addr still holds expected. The check and the block are
+// one step as far as ec440_wake() is concerned. Returns 0 once woken, EAGAIN straight away if
+// *addr did not hold expected. Callers check *addr again either way
+int ec440_wait(int *addr, int expected);
+
+// Wake up to n threads blocked in ec440_wait() on addr, longest waiting first. Returns how many woke
+int ec440_wake(int *addr, int n);
+
+//***************************************Statistics***************************************//
+
+// Scheduling counters of a thread. Also dumped for every thread on SIGUSR1
+typedef struct{
+	uint64_t switches;		// Times the thread was switched to
+	uint64_t preemptions;	// Times the CPU was taken away from it (quantum, or a more urgent thread)
+	uint64_t yields;		// Times it gave the CPU up itself, by blocking or yielding
+	uint64_t run_usecs;		// Time spent running
+	uint64_t ready_usecs;	// Time spent ready, waiting for a CPU
+	uint64_t sync_usecs;	// Time spent blocked on mutexes, barriers and the other sync primitives
+	uint64_t sleep_usecs;	// Time spent blocked in sleep() and friends
+	uint64_t io_usecs;		// Time spent blocked on I/O
+	size_t stack_size;		// Size of the thread's stack, 0 for main which runs on the process stack
+	size_t stack_peak;		// Most of the stack ever used, in bytes. Only measured with EC440_STACK_CHECK=1
+	int level;				// Ready queue the thread goes in, 0 runs first. Only moves with EC440_SCHED_POLICY=mlfq
+}ec440_thread_stats_t;
+
+// Copy the counters of a thread into stats. Returns ESRCH if the thread does not exist
+int ec440_thread_stats(pthread_t thread, ec440_thread_stats_t *stats);
+
+// Write the mutex contention counters to out, one line per place mutexes are initialised,
+// the most waited for first. Only counted with EC440_LOCKSTAT=<file>, which also writes them there at exit
+void ec440_lockstat_report(FILE *out);
+
+//***************************************Fibers***************************************//
+
+// A fiber has its own stack but only runs when switched to. It runs inside the thread
+// that switches to it, and the scheduler only ever sees that thread
+typedef pthread_t fiber_t;
+
+// Create a fiber that runs start_routine(arg) once switched to. Returns EAGAIN if the thread table is full
+int fiber_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg);
+
+// Context running now: a fiber, or the calling thread itself
+fiber_t fiber_self(void);
+
+// Suspend the running context and continue fiber, or the calling thread itself.
+// Returns 0 once something switches back, EBUSY if another thread is running fiber,
+// EINVAL if fiber cannot be switched to
+int fiber_switch_to(fiber_t fiber);
+
+// Run fiber until it yields or returns, and store the value it yielded or returned in value.
+// Returns true if it yielded and can be resumed again, false if it returned (and is gone) or cannot run.
+// A fiber another thread is running is not waited for: errno is set to EBUSY instead
+bool fiber_resume(fiber_t fiber, void **value);
+
+// Hand value to the context that resumed the running fiber and wait to be resumed again.
+// Returns 0 once resumed, EINVAL if the running context was not resumed by anyone
+int fiber_yield(void *value);
+
+//***************************************RCU***************************************//
+
+// Callback queued by call_rcu(), usually embedded in the structure it frees
+struct rcu_head{
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+// Publish a pointer to initialised data, which readers may pick up right away
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// Read a pointer published with rcu_assign_pointer(), inside a read-side critical section
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+// Start and end a read-side critical section. They nest, and take no lock
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+// Wait until every read-side critical section that was running when called has ended,
+// then run the call_rcu() callbacks queued before. Must not be called inside one
+void synchronize_rcu(void);
+
+// Run func(head) once a grace period has passed. Callbacks are batched, and run by
+// the thread whose call_rcu() fills the batch, by the next synchronize_rcu() or
+// rcu_barrier(), or at exit
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+
+// Wait for a grace period and run every callback queued so far
+void rcu_barrier(void);
+
+//***************************************Channels***************************************//
+
+// A bounded queue of fixed-size elements between threads, like a Go channel
+typedef struct channel chan_t;
+
+// Create a channel holding up to capacity elements of elem_size bytes. With capacity 0, every
+// send waits for a receiver. Returns NULL with errno set if elem_size is 0 or memory runs out
+chan_t *chan_create(size_t capacity, size_t elem_size);
+
+// Copy *elem into the channel, blocking while it is full. Returns 0, or EPIPE if it is closed
+int chan_send(chan_t *chan, const void *elem);
+
+// Copy the oldest element of the channel into *elem, blocking while it is empty.
+// Returns 0, or EPIPE once it is closed and empty
+int chan_recv(chan_t *chan, void *elem);
+
+// Wake every thread blocked on the channel. Sends fail from now on, receives once it is empty.
+// Returns EPIPE if it was already closed
+int chan_close(chan_t *chan);
+
+// Free a channel. Returns EBUSY while threads are blocked on it
+int chan_destroy(chan_t *chan);
+
+// One operation for chan_select(). Cases with a NULL chan are never ready
+typedef struct{
+	chan_t *chan;
+	bool send;		// Send *elem, or receive into *elem
+	void *elem;
+	int result;		// Set to what chan_send() or chan_recv() would have returned, for the case that ran
+}chan_case_t;
+
+// Run the first of n cases that can go ahead, and return its index. If none can, block until
+// one can, or return -1 straight away if block is false or every chan is NULL
+int chan_select(chan_case_t *cases, size_t n, bool block);
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef __EC440THREADS__
 #define __EC440THREADS__
 
+#define _GNU_SOURCE
+
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <setjmp.h>
@@ -10,6 +13,31 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <ucontext.h>
+
+// Older glibc headers only expose the SIGEV_THREAD_ID target through the union
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#include "ec440.h"
 
 /*
 static unsigned long int ptr_demangle(unsigned long int p)
@@ -44,6 +72,7 @@ static unsigned long int ptr_mangle(unsigned long int p)
 
 static void *start_thunk() {
   asm("popq %%rbp;\n"           //clean up the function prologue
+      "xorl %%ebp, %%ebp;\n"    //end the frame pointer chain, so unwinding stops at the entry function
       "movq %%r13, %%rdi;\n"    //put arg in $rdi
       "pushq %%r12;\n"          //push &start_routine
       "retq;\n"                 //return to &start_routine
@@ -71,23 +100,397 @@ enum thread_status{
 	TS_RUNNING,
 	TS_READY,
 	TS_EMPTY,
-	TS_BLOCKED
+	TS_BLOCKED,
+	TS_FIBER		// A fiber, which the scheduler never runs by itself
+};
+
+// Scheduling policies, picked with EC440_SCHED_POLICY
+enum sched_policy{
+	SP_RR,		// Round Robin within each priority level
+	SP_MLFQ,	// Multi-level feedback queue
+	SP_CFS		// Least virtual runtime first, weighted by priority
+};
+
+// What a TS_BLOCKED thread waits for, so that the time goes in the right counter
+enum block_reason{
+	BLOCK_SYNC,		// A mutex, condition, barrier or other sync primitive
+	BLOCK_SLEEP,	// The timer wheel
+	BLOCK_IO		// An fd in epoll
+};
+
+// Why a reschedule is pending
+enum resched_reason{
+	RESCHED_NONE,
+	RESCHED_TICK,		// The quantum ran out
+	RESCHED_WAKEUP,		// A thread on a higher level than the current one became ready
+	RESCHED_TIMER		// A sleeping thread in the timer wheel is due
 };
 
+// Thread-specific data slots kept inside each TCB. Keys past these go in a per-thread overflow table
+#define SPECIFIC_SLOTS 32
+
+// Most return addresses kept per profiler sample
+#define PROFILE_DEPTH 32
+
 // The thread control block stores information about a thread. 
 typedef struct thread_control_block{
 	pthread_t tid;
 	void *stack;
+	bool stack_shared;		// stack is a slice of one ec440_spawn_many() allocation and is never freed alone
+	void *(*start_routine) (void *);
 	jmp_buf regs;
 	enum thread_status status;
+	int priority;			// sched_priority, higher runs first
+	int level;				// Ready queue the thread goes in, 0 runs first
+	int worker;				// Worker whose ready queues hold the thread
+	pthread_t ready_next;	// Next thread in the same ready queue
+	uint64_t vruntime;		// Run time in microseconds scaled by the weight of the priority (SP_CFS)
+	int heap_index;			// Position in the worker's ready heap (SP_CFS)
+	uint64_t wake_tick;		// Timer wheel tick the thread sleeps until
+	int timer_slot;			// Timer wheel slot holding the thread, -1 if none
+	pthread_t timer_next;	// Next thread in the same timer wheel slot
+	pthread_t timer_prev;	// Previous thread in the same timer wheel slot
+	bool timed_out;			// Whether the timer wheel woke the thread up
+	int io_fd;				// File descriptor the thread waits on in epoll
+	uint32_t io_events;		// epoll events the thread waits for on io_fd
+	enum block_reason block_reason;	// What the thread waits for while TS_BLOCKED
+	uint64_t status_since;	// When the thread entered its current status, in monotonic microseconds
+	ec440_thread_stats_t stats;	// Counters for ec440_thread_stats()
+	jmp_buf fiber_regs;		// Saved context of a suspended fiber, or of a thread that switched to a fiber
+	pthread_t fiber_current;	// Context running on this thread: the thread itself or a fiber
+	pthread_t fiber_caller;	// Context that resumed this fiber and gets its next value
+	pthread_t fiber_from;	// Context that last switched to this one
+	void *fiber_value;		// Value the fiber last yielded or returned
+	bool fiber_running;		// Whether some thread is running this fiber
+	bool fiber_done;		// Whether start_routine returned and the fiber waits to be released
+	const void *specific[SPECIFIC_SLOTS];	// pthread_setspecific() values of the first keys
+	const void **specific_overflow;	// Values of the other keys, allocated on first use
+	int saved_errno;		// errno belongs to the kernel thread, so it is kept here while switched out
+	pthread_t wait_next;	// Next thread in the same wait_queue
+	const void *wait_addr;	// Address the thread waits on in Futex_Table, NULL if it is in no queue there
+	pthread_mutex_t *cond_mutex;	// Mutex to take back once woken from pthread_cond_wait()
+	uint64_t lock_wait_since;	// When the thread started waiting for a mutex (EC440_LOCKSTAT)
+	int rcu_nesting;		// Depth of rcu_read_lock() calls the thread is inside
+	uint64_t rcu_qs_seq;	// Last grace period the thread was seen outside a read-side critical section in
 }thread_control_block;
 
+// A kernel thread that runs green threads. There is more than one in M:N mode
+typedef struct{
+	bool started;			// Whether the kernel thread is up and its timer exists
+	pid_t ktid;				// Kernel thread the timer sends SIGALRM to
+	timer_t timer;			// Scheduling timer of this worker
+	useconds_t timer_usecs;	// Period the timer runs with, 0 while disarmed
+	jmp_buf idle_regs;		// Waits for work on the worker's own stack
+	void *idle_stack;		// Stack allocated for worker 0's idle context
+	timer_t profile_timer;	// CPU time timer that sends SIGPROF to the worker (EC440_PROFILE)
+}worker;
+
+// What SIGPROF found running: a context and its call stack, innermost first
+typedef struct{
+	pthread_t tid;			// Thread or fiber that was running, NO_THREAD for an idle worker
+	bool fiber;				// Whether tid was a fiber
+	int depth;				// Entries used in pc
+	uintptr_t pc[PROFILE_DEPTH];
+}profile_sample;
+
+// A distinct folded stack of the profile and how many samples had it
+typedef struct{
+	char *frames;			// Context name, then function names outermost first, separated by ';'
+	size_t count;
+}profile_stack;
+
+// Function symbols of the executable, read from its .symtab to name static functions too
+typedef struct{
+	void *image;			// The executable, mapped read-only
+	size_t size;
+	uintptr_t base;			// Address the symbol values are relative to
+	const Elf64_Sym *symbols;
+	size_t count;
+	const char *names;
+}symbol_table;
+
+// Contention counters of every mutex initialised at the same place (EC440_LOCKSTAT)
+typedef struct{
+	uintptr_t site;			// Return address of pthread_mutex_init(), or the mutex itself if statically initialised
+	bool initializer;		// Whether site is a PTHREAD_MUTEX_INITIALIZER mutex
+	uint64_t mutexes;		// Mutexes set up here
+	uint64_t acquisitions;
+	uint64_t contended;		// Acquisitions that had to wait for another thread
+	uint64_t wait_usecs;
+	uint64_t wait_max_usecs;
+	uint64_t hold_usecs;
+	uint64_t hold_max_usecs;
+	pthread_t longest_holder;	// Thread that held a mutex for hold_max_usecs
+}lock_site;
+
+// Top of the process stack, which thread 0 runs on
+extern void *__libc_stack_end;
+
+// A pthread_key_create() key
+typedef struct{
+	bool used;
+	void (*destructor)(void *);
+}key_info;
+
+// FIFO of TS_READY threads, linked through thread_control_block.ready_next
+typedef struct{
+	pthread_t head;
+	pthread_t tail;
+}ready_queue;
+
 // Schedule the thread execution using Round Robin 
 static void schedule();
 
+// Switch to the next thread. Must be called with preemption disabled by lock()
+static void context_switch();
+
+// SIGALRM handler, defers the context switch while preemption is disabled
+static void scheduler_tick(int signum, siginfo_t *info, void *context);
+
+// First function run on a new thread's stack
+static void thread_entry(void *arg);
+
+// Run a thread taken from the ready queues. Does not return
+static void dispatch(pthread_t tid, bool preempted);
+
+// Read EC440_WORKERS and start the extra kernel workers of M:N mode
+static void workers_init();
+
+// Create the scheduling timer of the calling kernel thread
+static void worker_start(int worker);
+
+// Entry point of the extra kernel workers
+static void *worker_main(void *arg);
+
+// Pick ready threads on a worker, sleeping while there is nothing to run or steal
+static void worker_idle(void *arg);
+
 // Initialising threads after the first call of pthread_create
 static void scheduler_init();
 
+// Set the library up with the caller as thread 0, unless it already is
+static void scheduler_start();
+
+// Find a TS_EMPTY or TS_EXITED slot in the thread table, or NO_THREAD if it is full
+static pthread_t tcb_find_empty();
+
+// Give the slots in tids that have no stack yet slices of a single allocation
+static void stack_alloc_many(const pthread_t *tids, size_t n);
+
+// Set a new thread up in slot tid and make it ready
+static void thread_init(pthread_t tid, const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg);
+
+// Give a thread or fiber a stack, unless its slot kept one, and make regs start entry(arg) on it
+static void context_init(pthread_t tid, jmp_buf regs, void (*entry)(void *), void *arg);
+
+// First function run on a fiber's stack
+static void fiber_entry(void *arg);
+
+// Save the running context and continue target, which the caller claimed. Returns the
+// context that switched back
+static pthread_t fiber_transfer(pthread_t target);
+
+// Mark the context that just switched to self as no longer running, and return it
+static pthread_t fiber_arrived(pthread_t self);
+
+// Check that fiber can run and mark it running in one step. Returns 0 on success,
+// EBUSY if another thread is running it, EINVAL if it cannot be switched to
+static int fiber_claim(fiber_t fiber);
+
+// Whether the calling thread may switch to fiber right now
+static bool fiber_can_run(fiber_t fiber);
+
+// Free a fiber whose start_routine returned, now that its stack is no longer in use
+static void fiber_release(pthread_t fiber);
+
+// Change the status of a thread and keep the runnable thread count up to date
+static void set_status(pthread_t tid, enum thread_status status);
+
+// Queue a thread that just became ready on the current worker, and ask for a switch if it
+// outranks the running one. Used by set_status() and to requeue a thread
+static void ready_wake(pthread_t tid);
+
+// Add the time spent in the current status up to now to the thread's counters
+static void stats_account(pthread_t tid);
+
+// Add elapsed microseconds in status to the matching counter of stats
+static void stats_charge(ec440_thread_stats_t *stats, enum thread_status status, enum block_reason reason, uint64_t elapsed);
+
+// Deepest a thread's stack ever got, found from the fill pattern (EC440_STACK_CHECK)
+static size_t stack_peak(pthread_t tid);
+
+// Abort if a thread wrote over the bottom of its stack (EC440_STACK_CHECK)
+static void stack_guard_check(pthread_t tid);
+
+// Write text into out padded with spaces to width, followed by a space. Returns the end.
+// Async-signal-safe, unlike snprintf()
+static char *stats_field(char *out, const char *text, int width, bool left);
+
+// stats_field() for a number, right-aligned
+static char *stats_number(char *out, uint64_t value, int width);
+
+// SIGUSR1 handler, prints the counters of every thread to stderr without taking lock()
+static void stats_dump(int signum);
+
+// Set the sampling profiler up: ring buffer, SIGPROF handler and the write at exit (EC440_PROFILE)
+static void profile_init();
+
+// Start the calling worker's SIGPROF timer, which counts the CPU time of its kernel thread
+static void profile_timer_start(int worker);
+
+// SIGPROF handler, records the running context and its frame pointer chain in the ring buffer
+static void profile_tick(int signum, siginfo_t *info, void *context);
+
+// Record the context a signal interrupted, given the slot holding the handler's return address.
+// Returns the interrupted frame pointer, or 0 if the context is not on the stack
+static uintptr_t profile_signal_frame(profile_sample *sample, uintptr_t *slot, uintptr_t high);
+
+// Write the samples to the EC440_PROFILE file as folded stacks, one line per distinct stack
+static void profile_write();
+
+// qsort() order of samples that puts identical stacks next to each other
+static int profile_compare(const void *a, const void *b);
+
+// qsort() order of folded stacks, by their text
+static int profile_stack_compare(const void *a, const void *b);
+
+// Folded stack text of a sample, allocated with malloc()
+static char *profile_fold(const profile_sample *sample, const symbol_table *table);
+
+// Map the executable and find its symbol table. Leaves table empty if it has none
+static void symbols_load(symbol_table *table);
+
+// Name of the function or variable holding pc, or module+offset when it has no symbol
+static const char *symbol_name(const symbol_table *table, uintptr_t pc, char *buf, size_t len);
+
+// Set the mutex contention counters up, and their write at exit (EC440_LOCKSTAT)
+static void lockstat_init();
+
+// Index of the counters of a site in Lock_Sites, added if new. 0 if the table is full or
+// counting is off. Must be called with lock() held
+static uint16_t lockstat_site(uintptr_t site, bool initializer);
+
+// Write the report to the EC440_LOCKSTAT file at exit
+static void lockstat_write();
+
+// qsort() order of sites, most time waited first
+static int lockstat_compare(const void *a, const void *b);
+
+// Whether any runnable thread is waiting for a CPU, so that the SIGALRM timers have to run
+static bool scheduler_timer_needed();
+
+// Start the SIGALRM timers as soon as more than one thread is runnable
+static void scheduler_timer_update();
+
+// Stop this worker's SIGALRM timer on a tick that finds it no longer needed
+static void scheduler_timer_expire();
+
+// Park the process until a signal arrives when no thread is runnable
+static void scheduler_idle();
+
+// Microseconds on CLOCK_MONOTONIC
+static uint64_t monotonic_usecs();
+
+// Current timer wheel tick
+static uint64_t timer_now();
+
+// Timer wheel tick at least usecs from now
+static uint64_t timer_after(uint64_t usecs);
+
+// Timer wheel tick of a CLOCK_REALTIME deadline
+static uint64_t timer_deadline(const struct timespec *abstime);
+
+// Put a thread in the timer wheel slot matching its wake_tick
+static void timer_insert(pthread_t tid);
+
+// Take a thread out of the timer wheel
+static void timer_remove(pthread_t tid);
+
+// Move the wheel up to the current tick and wake every thread that is due
+static void timer_advance();
+
+// Arm the wheel timer for the next tick at which a slot needs processing
+static void wheel_timer_update();
+
+// Block the current thread until it is woken up or wake_tick passes. Returns true on timeout
+static bool timer_block(uint64_t wake_tick);
+
+// Whether fd was put in non-blocking mode by its owner, who then expects EAGAIN instead of a wait
+static bool io_nonblocking(int fd);
+
+// Block the current thread until fd is ready for events, parking it in epoll if it is not.
+// Threads waiting on the same fd share its registration, which asks for all their events
+static void io_wait(int fd, uint32_t events);
+
+// Events the threads waiting on fd ask for together, 0 if none waits
+static uint32_t io_interest(int fd);
+
+// io_wait() taking lock(), unless the owner put fd in O_NONBLOCK mode. Returns false in
+// that case, when the call should fail with EAGAIN instead of being retried
+static bool io_block(int fd, uint32_t events);
+
+// Whether epoll can tell when fd is ready. Files on disk always look ready
+static bool io_pollable(int fd);
+
+// Make the threads whose fds became ready runnable, waiting up to timeout ms (-1 forever) with mask set
+static void io_poll(int timeout, const sigset_t *mask);
+
+// Make the threads waiting on fd for any of ready runnable, and re-arm fd for the others
+static void io_ready(int fd, uint32_t ready);
+
+// Read the quantum settings from the environment, once
+static void quantum_config();
+
+// Start a worker's SIGALRM timer with the given period, or stop it if usecs is 0
+static void worker_timer_arm(int worker, useconds_t usecs);
+
+// Pick the next quantum in adaptive mode, given how the last one ended
+static void quantum_adapt(bool preempted);
+
+// Highest ready queue level a thread may run at, given its priority
+static int top_level(pthread_t tid);
+
+// Put a thread at the tail of a worker's ready queue for its level
+static void ready_enqueue(pthread_t tid, int worker);
+
+// Take the first thread of a worker's highest non-empty ready queue, or NO_THREAD
+static pthread_t ready_dequeue(int worker);
+
+// Take the next thread to run from the local ready queues, or steal one from another worker
+static pthread_t ready_pick();
+
+// Take a thread out of its ready queue
+static void ready_remove(pthread_t tid);
+
+// Slot holding the current thread's value of key, allocating the overflow table if needed
+static const void **specific_slot(pthread_key_t key, bool allocate);
+
+// Call the destructors of the current thread's non-NULL values, PTHREAD_DESTRUCTOR_ITERATIONS times at most
+static void specific_destroy();
+
+// Whether a thread that just became ready should take the CPU from the running one
+static bool wakeup_preempts(pthread_t tid);
+
+// CPU share weight of a thread's priority (SP_CFS)
+static uint64_t cfs_weight(pthread_t tid);
+
+// Start a thread that becomes ready close to the least-served thread, so that a long sleep does not
+// turn into a long claim on the CPU (SP_CFS)
+static void cfs_place(pthread_t tid);
+
+// Whether thread a runs before thread b: less vruntime first, then higher priority (SP_CFS)
+static bool cfs_before(pthread_t a, pthread_t b);
+
+// Move a thread up or down a worker's ready heap until the heap is ordered again (SP_CFS)
+static void cfs_sift_up(int worker, int index);
+static void cfs_sift_down(int worker, int index);
+
+// Demote threads that used their whole quantum and boost threads that blocked early
+static void mlfq_account(pthread_t tid, bool preempted);
+
+// Move every thread back to its top level so that demoted threads do not starve
+static void mlfq_boost();
+
 // Creating a thread
 int pthread_create(
 	pthread_t *thread, const pthread_attr_t *attr,
@@ -99,80 +502,175 @@ void pthread_exit(void *value_ptr);
 // ID of the current thread
 pthread_t pthread_self(void);
 
+// Change the priority of a thread
+int pthread_setschedprio(pthread_t thread, int prio);
+
+// Give the CPU to the next ready thread
+int sched_yield(void);
+
+// Thread-specific data
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
+int pthread_key_delete(pthread_key_t key);
+int pthread_setspecific(pthread_key_t key, const void *value);
+void *pthread_getspecific(pthread_key_t key);
+
+// Sleep in the timer wheel, letting the other threads run
+unsigned int sleep(unsigned int seconds);
+int usleep(useconds_t usec);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+
+// I/O that blocks the calling thread instead of the kernel thread when fd is not ready
+ssize_t read(int fd, void *buf, size_t count);
+ssize_t write(int fd, const void *buf, size_t count);
+int accept(int fd, __SOCKADDR_ARG addr, socklen_t *restrict addrlen);
+int connect(int fd, __CONST_SOCKADDR_ARG addr, socklen_t addrlen);
+ssize_t recv(int fd, void *buf, size_t len, int flags);
+ssize_t send(int fd, const void *buf, size_t len, int flags);
+
 //***************************************Thread Sync***************************************//
 
-// Lock SIGALRM
-static void lock(){
-	sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGALRM);
-    sigprocmask(SIG_BLOCK, &set, NULL);
+// Preemption of the current worker is disabled while this is non-zero
+static __thread volatile sig_atomic_t preempt_count = 0;
+
+// Set to a resched_reason when a context switch was deferred by lock()
+static __thread volatile sig_atomic_t resched_pending = RESCHED_NONE;
+
+// Number of kernel workers running green threads
+static int worker_count = 1;
+
+// Guards the scheduler and the sync primitives while several workers are running
+static volatile int scheduler_spinlock = 0;
+
+// Take the scheduler spinlock. Gives the core up now and then in case the holder was descheduled.
+// sched_yield() is ours and switches green threads, so ask the kernel directly
+static void scheduler_spin_lock(){
+	while(__atomic_exchange_n(&scheduler_spinlock, 1, __ATOMIC_ACQUIRE)){
+		for(int spins = 1; __atomic_load_n(&scheduler_spinlock, __ATOMIC_RELAXED); spins++){
+			if(spins % 1024 == 0){
+				syscall(SYS_sched_yield);
+			}
+			__builtin_ia32_pause();
+		}
+	}
 }
 
-// Unlock SIGALRM
-static void unlock(){
-	sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGALRM);
-    sigprocmask(SIG_UNBLOCK, &set, NULL);
+// Release the scheduler spinlock
+static void scheduler_spin_unlock(){
+	__atomic_store_n(&scheduler_spinlock, 0, __ATOMIC_RELEASE);
 }
 
-// Linked list struct
-typedef struct linked_list{
-	pthread_t tid;
-	struct linked_list *next;
-}linked_list;
-
-// Put on the tail of the linked list
-static void insert_tail(linked_list **list, linked_list **tail, pthread_t tid) {
-    linked_list *to_ins = (linked_list *) malloc(sizeof(linked_list));
-
-    to_ins->tid = tid;
-    to_ins->next = NULL;
-
-    if ((*list) == NULL) {
-        (*list) = to_ins;
-        (*tail) = to_ins;
-    } else {
-        list = &((*tail)->next);
-        (*list) = to_ins;
-        (*tail) = to_ins;
-    }
+// Disable preemption, and keep the other workers out in M:N mode. Nests, and costs no syscall
+static void lock(){
+	if(preempt_count++ == 0 && worker_count > 1){
+		scheduler_spin_lock();
+	}
 }
 
-// Get the head of the linked list
-static void get_head(linked_list **list, linked_list **tail, pthread_t *tid) {
-    linked_list *to_del;
-
-    to_del = (*list);
-    if (tid != NULL) {
-        (*tid) = to_del->tid;
-    }
-    (*list) = to_del->next;
-    free(to_del);
-    if ((*list) == NULL) {
-        (*tail) = NULL;
-    }
+// Re-enable preemption and run any context switch that was deferred meanwhile
+static void unlock(){
+	// The spinlock goes first: a tick that lands in between must still see preemption disabled
+	if(preempt_count == 1 && worker_count > 1){
+		scheduler_spin_unlock();
+	}
+	if(--preempt_count == 0 && resched_pending){
+		schedule();
+	}
 }
 
-// Check if the linked list is empty
-static bool is_empty(linked_list *list) {
-    return (list == NULL);
-}
+// FIFO of blocked threads, linked through thread_control_block.wait_next.
+// A thread waits in at most one queue at a time, so blocking never allocates
+typedef struct{
+	pthread_t head;
+	pthread_t tail;
+}wait_queue;
+
+// Put a thread at the tail of a wait queue
+static void wait_enqueue(wait_queue *queue, pthread_t tid);
+
+// Take a thread out of a wait queue, returns false if it was not there
+static bool wait_remove(wait_queue *queue, pthread_t tid);
+
+// Bucket of Futex_Table that threads waiting on addr are queued in
+static wait_queue *futex_bucket(const void *addr);
+
+// Bucket of IO_Table that threads waiting on fd are queued in
+static wait_queue *io_bucket(int fd);
+
+// Queue tid up on addr, without blocking it. Every futex_ function must be called with lock() held
+static void futex_enqueue(const void *addr, pthread_t tid);
+
+// Take the thread that has waited longest on addr out of the table, or NO_THREAD if none waits
+static pthread_t futex_dequeue(const void *addr);
+
+// Take tid out of the table if it still waits on addr. Returns false if it does not
+static bool futex_remove(const void *addr, pthread_t tid);
+
+// Whether any thread waits on addr
+static bool futex_waiting(const void *addr);
+
+// Block the calling thread on addr until something takes it out of the table
+static void futex_wait(const void *addr);
+
+// Make up to n threads waiting on addr ready, longest waiting first. Returns how many
+static int futex_wake(const void *addr, int n);
 
-// State of the mutex
+// State of the mutex. A zeroed mutex is unlocked, as PTHREAD_MUTEX_INITIALIZER expects
 typedef enum{
-	LOCKED,
-	UNLOCKED
+	UNLOCKED,
+	LOCKED
 }mutex_state;
 
-// Mutex struct
+// Mutex struct, kept inside the pthread_mutex_t itself
 typedef struct{
+	bool initialised;		// False in a PTHREAD_MUTEX_INITIALIZER mutex until its first use
+	uint16_t site;			// Counters in Lock_Sites, 0 if not counted (EC440_LOCKSTAT)
 	mutex_state state;
-	linked_list *wait_list;
-	linked_list *wait_list_tail;
+	pthread_t owner;		// Thread holding the mutex. unlock() hands it to the first waiter directly
+	uint64_t locked_at;		// When owner got the mutex, in microseconds (EC440_LOCKSTAT)
 }MutexControlBlock;
 
+_Static_assert(sizeof(MutexControlBlock) <= sizeof(pthread_mutex_t), "MutexControlBlock must fit in pthread_mutex_t");
+
+// The control block inside a mutex, set up on first use. Must be called with lock() held
+static MutexControlBlock *mutex_block(pthread_mutex_t *mutex);
+
+// Set up an unlocked mutex whose contention is counted under site. Must be called with lock() held
+static void mutex_setup(MutexControlBlock *MCB, uintptr_t site, bool initializer);
+
+// Queue tid up for a mutex. Must be called with lock() held
+static void mutex_wait(MutexControlBlock *MCB, pthread_t tid);
+
+// Count an acquisition of a mutex by tid, which waited since lock_wait_since if contended
+static void lockstat_acquired(MutexControlBlock *MCB, pthread_t tid, bool contended);
+
+// Count the end of the current owner's hold of a mutex
+static void lockstat_released(MutexControlBlock *MCB);
+
+// Take a mutex, blocking until it is handed over if it is locked. Must be called with lock() held
+static void mutex_acquire(MutexControlBlock *MCB);
+
+// Unlock a mutex, or hand it to its first waiter. Must be called with lock() held
+static void mutex_release(MutexControlBlock *MCB);
+
+// Wake a thread taken off a condition variable. It gets its mutex if that is free, and
+// otherwise waits for it in the mutex's queue instead of running just to block again
+static void cond_wake(pthread_t tid);
+
+// Record that the current thread is outside any read-side critical section, if it is
+static void rcu_quiescent_state();
+
+// Whether a thread cannot hold references from before grace period target started
+static bool rcu_quiescent(pthread_t tid, uint64_t target);
+
+// Make the other workers record a quiescent state for the thread they are running
+static void rcu_kick();
+
+// Run a batch of call_rcu() callbacks taken off rcu_pending, oldest first
+static void rcu_run(struct rcu_head *batch);
+
+// Mark the batch synchronize_rcu() took as ticket done, once the ones taken before it are
+static void rcu_batch_done(uint64_t ticket);
+
 // Mutex initialiser
 int pthread_mutex_init(pthread_mutex_t *restrict mutex, const pthread_mutexattr_t *restrict attr);
 
@@ -185,19 +683,156 @@ int pthread_mutex_lock(pthread_mutex_t *mutex);
 // Unlock the mutex
 int pthread_mutex_unlock(pthread_mutex_t *mutex);
 
-// Barrier struct
+// Lock the mutex, giving up at abstime (CLOCK_REALTIME)
+int pthread_mutex_timedlock(pthread_mutex_t *restrict mutex, const struct timespec *restrict abstime);
+
+// Condition variable initialiser. attr is ignored, timeouts are always on CLOCK_REALTIME
+int pthread_cond_init(pthread_cond_t *restrict cond, const pthread_condattr_t *restrict attr);
+
+// Condition variable destructor. Returns EBUSY while threads wait on it
+int pthread_cond_destroy(pthread_cond_t *cond);
+
+// Unlock mutex and wait for a signal in one step, then lock mutex again
+int pthread_cond_wait(pthread_cond_t *restrict cond, pthread_mutex_t *restrict mutex);
+
+// Like pthread_cond_wait(), but gives up at abstime (CLOCK_REALTIME) and returns ETIMEDOUT
+int pthread_cond_timedwait(pthread_cond_t *restrict cond, pthread_mutex_t *restrict mutex,
+	const struct timespec *restrict abstime);
+
+// Wake the thread that has waited longest on the condition
+int pthread_cond_signal(pthread_cond_t *cond);
+
+// Wake every thread waiting on the condition
+int pthread_cond_broadcast(pthread_cond_t *cond);
+
+// Reader-writer lock struct, kept inside the pthread_rwlock_t itself
+typedef struct{
+	bool initialised;		// False in a PTHREAD_RWLOCK_INITIALIZER lock until its first use
+	unsigned readers;		// Threads holding the lock for reading
+	pthread_t writer;		// Thread holding the lock for writing, or NO_THREAD
+	unsigned writers_waiting;	// Writers blocked on &writer. Readers block on &readers
+}RwlockControlBlock;
+
+_Static_assert(sizeof(RwlockControlBlock) <= sizeof(pthread_rwlock_t), "RwlockControlBlock must fit in pthread_rwlock_t");
+
+// The control block inside a reader-writer lock, set up on first use. Must be called with lock() held
+static RwlockControlBlock *rwlock_block(pthread_rwlock_t *rwlock);
+
+// Reader-writer lock initialiser. attr is ignored, writers are always preferred
+int pthread_rwlock_init(pthread_rwlock_t *restrict rwlock, const pthread_rwlockattr_t *restrict attr);
+
+// Reader-writer lock destructor. Returns EBUSY while the lock is held or waited on
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock);
+
+// Lock for reading, blocking while a writer holds the lock or waits for it
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock);
+
+// Lock for reading if that needs no wait, otherwise return EBUSY
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock);
+
+// Lock for writing, blocking while anyone holds the lock
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock);
+
+// Lock for writing if nobody holds the lock, otherwise return EBUSY
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock);
+
+// Release a read or write lock, and hand the lock to the next writer or to every waiting reader
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock);
+
+// Semaphore struct, kept inside the sem_t itself
+typedef struct{
+	unsigned value;
+}SemaphoreControlBlock;
+
+_Static_assert(sizeof(SemaphoreControlBlock) <= sizeof(sem_t), "SemaphoreControlBlock must fit in sem_t");
+
+// Semaphore initialiser. Semaphores shared between processes are not supported
+int sem_init(sem_t *sem, int pshared, unsigned value);
+
+// Semaphore destructor. Fails with EBUSY while threads wait on it
+int sem_destroy(sem_t *sem);
+
+// Take one from the semaphore, blocking while it is 0
+int sem_wait(sem_t *sem);
+
+// Take one from the semaphore if it is above 0, otherwise fail with EAGAIN
+int sem_trywait(sem_t *sem);
+
+// Like sem_wait(), but gives up at abstime (CLOCK_REALTIME) and fails with ETIMEDOUT
+int sem_timedwait(sem_t *restrict sem, const struct timespec *restrict abstime);
+
+// Add one to the semaphore, or hand it straight to the first waiter
+int sem_post(sem_t *sem);
+
+// Store the value of the semaphore in sval, which is 0 while threads wait
+int sem_getvalue(sem_t *restrict sem, int *restrict sval);
+
+// A thread blocked on a channel, kept on its own stack. chan_select() queues one per case,
+// so unlike a wait_queue, a thread can wait on several channels at once
+typedef struct chan_waiter{
+	struct chan_waiter *next;
+	pthread_t tid;
+	void *elem;				// Element to send, or where to receive it
+	int index;				// Case of chan_select() it stands for
+	struct chan_wait *wait;	// Shared by every waiter of the same chan_select()
+}chan_waiter;
+
+// What a blocked chan_select() was woken up for
+typedef struct chan_wait{
+	int selected;			// Case that went ahead, -1 until one does
+	int result;				// Its result, 0 or EPIPE
+}chan_wait;
+
 typedef struct{
-	char init;
-	char flag;
-	pthread_t calling_thread;
-	unsigned count;
-	unsigned left;
+	chan_waiter *head;
+	chan_waiter *tail;
+}chan_queue;
+
+// Channel struct, with its ring buffer right behind it
+struct channel{
+	size_t capacity;
+	size_t elem_size;
+	size_t head;			// Oldest element in the buffer
+	size_t count;			// Elements in the buffer
+	bool closed;
+	chan_queue senders;
+	chan_queue receivers;
+	char buffer[];
+};
+
+// Append a waiter to a channel's queue
+static void chan_enqueue(chan_queue *queue, chan_waiter *waiter);
+
+// Take the first waiter whose chan_select() has not gone ahead yet off a channel's queue, or NULL.
+// Waiters of selects that went ahead on another channel are dropped on the way
+static chan_waiter *chan_dequeue(chan_queue *queue);
+
+// Whether a thread still waits in a channel's queue
+static bool chan_waiting(chan_queue *queue);
+
+// Take a waiter off a channel's queue, if it is still there
+static void chan_remove(chan_queue *queue, chan_waiter *waiter);
+
+// Let the chan_select() of a dequeued waiter go ahead with its case, and wake its thread
+static void chan_fire(chan_waiter *waiter, int result);
+
+// Run one case without blocking. Returns 0 or EPIPE if it went ahead, EAGAIN if it would block.
+// Must be called with lock() held
+static int chan_try(chan_case_t *c);
+
+// Barrier struct, kept inside the pthread_barrier_t itself
+typedef struct{
+	unsigned count;			// Threads that must arrive before any leaves
+	unsigned left;			// Threads still missing in the current generation
+	unsigned generation;	// Incremented every time the barrier opens. Waiters block on its address
 }BarrierControlBlock;
 
+_Static_assert(sizeof(BarrierControlBlock) <= sizeof(pthread_barrier_t), "BarrierControlBlock must fit in pthread_barrier_t");
+
 // Barrier initialiser
 int pthread_barrier_init(pthread_barrier_t *restrict barrier, const pthread_barrierattr_t *restrict attr, unsigned count);
 
-// Barrier destructor
+// Barrier destructor. Returns EBUSY while threads wait on it
 int pthread_barrier_destroy(pthread_barrier_t *barrier);
 
 // Filling the barrier
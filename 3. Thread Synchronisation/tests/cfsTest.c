@@ -0,0 +1,83 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<unistd.h>
+#include "ec440.h"
+
+#define EQUAL_CNT 2
+#define RUN_USECS 1500000
+#define QUANTUM_USECS 5000
+
+pthread_t threads[EQUAL_CNT + 1];
+volatile int done;
+volatile long wakeups;
+
+void* spin(void *arg){
+	while(!done){
+	}
+	return NULL;
+}
+
+void* interactive(void *arg){
+	// Mostly asleep, so it should get the CPU as soon as it wakes up
+	while(!done){
+		usleep(2000);
+		wakeups++;
+	}
+	return NULL;
+}
+
+void createWithPriority(pthread_t *thread, int priority, void *(*start_routine) (void *)){
+	pthread_attr_t attr;
+	struct sched_param param = {priority};
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, priority ? SCHED_RR : SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_create(thread, &attr, start_routine, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+int main(int argc, char **argv) {
+	pthread_t sleeper;
+	ec440_thread_stats_t stats[EQUAL_CNT + 1];
+
+	// The CPU shares below only hold with a single kernel worker
+	setenv("EC440_SCHED_POLICY", "cfs", 1);
+	setenv("EC440_WORKERS", "1", 1);
+	ec440_set_quantum(QUANTUM_USECS);
+
+	// Two priority 0 threads, and a priority 1 thread that weighs as much as both
+	for(int i = 0; i < EQUAL_CNT; i++){
+		createWithPriority(&threads[i], 0, &spin);
+	}
+	createWithPriority(&threads[EQUAL_CNT], 1, &spin);
+	createWithPriority(&sleeper, 0, &interactive);
+
+	usleep(RUN_USECS);
+	for(int i = 0; i <= EQUAL_CNT; i++){
+		ec440_thread_stats(threads[i], &stats[i]);
+		printf("thread %lx ran %lu ms\n", threads[i], stats[i].run_usecs / 1000);
+	}
+	done = 1;
+
+	double ratio = (double) stats[0].run_usecs / stats[1].run_usecs;
+	if(ratio < 0.8 || ratio > 1.25){
+		printf("Error, threads of the same priority got unequal shares\n");
+		exit(-1);
+	}
+	ratio = (double) stats[EQUAL_CNT].run_usecs / (stats[0].run_usecs + stats[1].run_usecs);
+	if(ratio < 0.8 || ratio > 1.25){
+		printf("Error, the priority 1 thread did not get twice the share of a priority 0 thread\n");
+		exit(-1);
+	}
+
+	// The sleeper wakes up every 2 ms. Waiting for whole quanta would give it a few dozen wakeups at most
+	printf("interactive thread woke up %ld times\n", wakeups);
+	if(wakeups < RUN_USECS / QUANTUM_USECS){
+		printf("Error, the interactive thread waited too long for the CPU\n");
+		exit(-1);
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<errno.h>
+#include "ec440.h"
+
+#define ITEMS 2000
+#define STAGE_CNT 3
+#define SELECT_ITEMS 500
+
+typedef struct{
+	long id;
+	long value;
+}message;
+
+// A pipeline: the source sends through an unbuffered channel, and every stage adds its number
+chan_t *stages[STAGE_CNT + 1];
+chan_t *left, *right;
+volatile int finished;
+
+void* stage(void *arg){
+	int self = (int)(intptr_t) arg;
+	message msg;
+
+	while(chan_recv(stages[self], &msg) == 0){
+		msg.value += self;
+		chan_send(stages[self + 1], &msg);
+	}
+	chan_close(stages[self + 1]);
+	finished++;
+	return NULL;
+}
+
+void* source(void *arg){
+	for(long i = 1; i <= ITEMS; i++){
+		message msg = {i, i};
+		chan_send(stages[0], &msg);
+	}
+	chan_close(stages[0]);
+	finished++;
+	return NULL;
+}
+
+void* producer(void *arg){
+	chan_t *chan = arg;
+	for(int i = 1; i <= SELECT_ITEMS; i++){
+		chan_send(chan, &i);
+	}
+	chan_close(chan);
+	finished++;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+
+	// Unbuffered, then buffered channels between the stages
+	for(int i = 0; i <= STAGE_CNT; i++){
+		stages[i] = chan_create(i == 0 ? 0 : 4, sizeof(message));
+	}
+	for(int i = 0; i < STAGE_CNT; i++){
+		pthread_create(&tid, NULL, &stage, (void *)(intptr_t) i);
+	}
+	pthread_create(&tid, NULL, &source, NULL);
+
+	message msg;
+	long expected = 1, sum = 0;
+	while(chan_recv(stages[STAGE_CNT], &msg) == 0){
+		if(msg.id != expected++){
+			printf("Error, message %ld arrived out of order\n", msg.id);
+			exit(-1);
+		}
+		sum += msg.value;
+	}
+	long total = (long) ITEMS * (ITEMS + 1) / 2 + (long) ITEMS * (STAGE_CNT * (STAGE_CNT - 1) / 2);
+	if(expected != ITEMS + 1 || sum != total){
+		printf("Error, %ld messages summing to %ld instead of %ld\n", expected - 1, sum, total);
+		exit(-1);
+	}
+	while(finished < STAGE_CNT + 1){
+		sched_yield();
+	}
+	message late = {0, 0};
+	if(chan_send(stages[0], &late) != EPIPE || chan_close(stages[0]) != EPIPE){
+		printf("Error, a closed channel took a message\n");
+		exit(-1);
+	}
+	for(int i = 0; i <= STAGE_CNT; i++){
+		chan_destroy(stages[i]);
+	}
+
+	// Select over two producers until both have closed their channels
+	left = chan_create(0, sizeof(int));
+	right = chan_create(2, sizeof(int));
+	int fromLeft, fromRight;
+	chan_case_t cases[2] = {{left, false, &fromLeft, 0}, {right, false, &fromRight, 0}};
+	if(chan_select(cases, 2, false) != -1){
+		printf("Error, a select on empty channels went ahead\n");
+		exit(-1);
+	}
+	finished = 0;
+	pthread_create(&tid, NULL, &producer, left);
+	pthread_create(&tid, NULL, &producer, right);
+
+	long leftSum = 0, rightSum = 0;
+	while(cases[0].chan != NULL || cases[1].chan != NULL){
+		int ready = chan_select(cases, 2, true);
+		if(cases[ready].result == EPIPE){
+			cases[ready].chan = NULL;
+		}
+		else if(ready == 0){
+			leftSum += fromLeft;
+		}
+		else{
+			rightSum += fromRight;
+		}
+	}
+	long selectTotal = (long) SELECT_ITEMS * (SELECT_ITEMS + 1) / 2;
+	if(leftSum != selectTotal || rightSum != selectTotal){
+		printf("Error, select received %ld and %ld instead of %ld\n", leftSum, rightSum, selectTotal);
+		exit(-1);
+	}
+	while(finished < 2){
+		sched_yield();
+	}
+	if(chan_destroy(left) != 0 || chan_destroy(right) != 0){
+		printf("Error, the channels could not be destroyed\n");
+		exit(-1);
+	}
+	printf("%d messages through %d stages, %d from each side of a select\n", ITEMS, STAGE_CNT, SELECT_ITEMS);
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<errno.h>
+#include<time.h>
+#include "ec440.h"
+
+#define PRODUCER_CNT 3
+#define CONSUMER_CNT 3
+#define ITEMS 2000
+#define SLOTS 8
+#define WAITER_CNT 5
+
+// A bounded buffer, with one condition for each side
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t notFull = PTHREAD_COND_INITIALIZER;
+pthread_cond_t notEmpty;
+int buffer[SLOTS];
+int head, count, produced;
+long consumedSum;
+
+pthread_cond_t go = PTHREAD_COND_INITIALIZER;
+int started, woken, released, intruded;
+volatile int finished;
+
+void* intruder(void *arg){
+	pthread_mutex_lock(&mutex);
+	intruded = 1;
+	finished++;
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+void* producer(void *arg){
+	for(;;){
+		pthread_mutex_lock(&mutex);
+		while(count == SLOTS && produced < ITEMS){
+			pthread_cond_wait(&notFull, &mutex);
+		}
+		if(produced == ITEMS){
+			finished++;
+			pthread_mutex_unlock(&mutex);
+			return NULL;
+		}
+		buffer[(head + count) % SLOTS] = ++produced;
+		count++;
+		pthread_cond_signal(&notEmpty);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+void* consumer(void *arg){
+	for(;;){
+		pthread_mutex_lock(&mutex);
+		while(count == 0 && produced < ITEMS){
+			pthread_cond_wait(&notEmpty, &mutex);
+		}
+		if(count == 0){
+			finished++;
+			pthread_mutex_unlock(&mutex);
+			return NULL;
+		}
+		consumedSum += buffer[head];
+		head = (head + 1) % SLOTS;
+		count--;
+		pthread_cond_signal(&notFull);
+		if(produced == ITEMS){
+			pthread_cond_broadcast(&notEmpty);
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+// Each waiter must hold the mutex when it comes back from the wait
+void* waiter(void *arg){
+	pthread_mutex_lock(&mutex);
+	started++;
+	while(!released){
+		pthread_cond_wait(&go, &mutex);
+	}
+	woken++;
+	finished++;
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t threads[PRODUCER_CNT + CONSUMER_CNT + WAITER_CNT];
+	pthread_cond_init(&notEmpty, NULL);
+
+	for(int i = 0; i < PRODUCER_CNT; i++){
+		pthread_create(&threads[i], NULL, &producer, NULL);
+	}
+	for(int i = PRODUCER_CNT; i < PRODUCER_CNT + CONSUMER_CNT; i++){
+		pthread_create(&threads[i], NULL, &consumer, NULL);
+	}
+	while(finished < PRODUCER_CNT + CONSUMER_CNT){
+		sched_yield();
+	}
+	if(consumedSum != (long) ITEMS * (ITEMS + 1) / 2){
+		printf("Error, consumed a sum of %ld instead of %ld\n", consumedSum, (long) ITEMS * (ITEMS + 1) / 2);
+		exit(-1);
+	}
+
+	// A timed wait without a signal gives up, and still takes the mutex back
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 50000000;
+	if(deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&mutex);
+	if(pthread_cond_timedwait(&notEmpty, &mutex, &deadline) != ETIMEDOUT){
+		printf("Error, the timed wait was not given up\n");
+		exit(-1);
+	}
+	pthread_create(&threads[0], NULL, &intruder, NULL);
+	for(int i = 0; i < 10; i++){
+		sched_yield();
+	}
+	if(intruded){
+		printf("Error, the mutex was not held after the timed wait\n");
+		exit(-1);
+	}
+	pthread_mutex_unlock(&mutex);
+	while(finished < PRODUCER_CNT + CONSUMER_CNT + 1){
+		sched_yield();
+	}
+
+	// Waiters cost nothing while blocked, and a broadcast lets every one of them through
+	for(int i = 0; i < WAITER_CNT; i++){
+		pthread_create(&threads[i], NULL, &waiter, NULL);
+	}
+	while(started < WAITER_CNT){
+		sched_yield();
+	}
+	struct timespec pause = {0, 50000000};
+	nanosleep(&pause, NULL);
+	for(int i = 0; i < WAITER_CNT; i++){
+		ec440_thread_stats_t stats;
+		ec440_thread_stats(threads[i], &stats);
+		if(stats.run_usecs > 20000){
+			printf("Error, a blocked waiter ran for %lu us\n", (unsigned long) stats.run_usecs);
+			exit(-1);
+		}
+	}
+	pthread_mutex_lock(&mutex);
+	released = 1;
+	pthread_cond_broadcast(&go);
+	pthread_mutex_unlock(&mutex);
+	while(finished < PRODUCER_CNT + CONSUMER_CNT + 1 + WAITER_CNT){
+		sched_yield();
+	}
+	if(woken != WAITER_CNT || pthread_cond_destroy(&go) != 0){
+		printf("Error, %d of %d waiters were woken\n", woken, WAITER_CNT);
+		exit(-1);
+	}
+	printf("%d items passed through %d slots, %d waiters broadcast\n", ITEMS, SLOTS, WAITER_CNT);
+	return 0;
+}
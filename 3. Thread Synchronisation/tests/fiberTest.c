@@ -0,0 +1,166 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<stdint.h>
+#include<errno.h>
+#include<time.h>
+#include "ec440.h"
+
+#define GENERATED_CNT 10
+#define FIBER_CNT 500
+#define PING_PONG_CNT 1000
+#define RESUMER_CNT 3
+#define SHARED_CNT 2000
+
+fiber_t pinger, ponger;
+int pings, pongs;
+int turn;
+
+fiber_t held, shared;
+volatile int holding, contender_errno;
+volatile int finished;
+int seen[SHARED_CNT];
+
+void* generator(void *arg){
+	for(intptr_t i = 0; i < GENERATED_CNT; i++){
+		fiber_yield((void *) i);
+	}
+	return (void *) -1;
+}
+
+void* holder(void *arg){
+	// Stay on this thread's stack until the contender has tried to take the fiber over
+	struct timespec nap = {0, 1000000};
+	holding = 1;
+	while(contender_errno == 0){
+		nanosleep(&nap, NULL);
+	}
+	return NULL;
+}
+
+void* contender(void *arg){
+	while(!holding){
+		sched_yield();
+	}
+	contender_errno = fiber_resume(held, NULL) ? -1 : errno;
+	return NULL;
+}
+
+void* counter(void *arg){
+	for(intptr_t i = 0; i < SHARED_CNT; i++){
+		fiber_yield((void *) i);
+	}
+	return (void *) -1;
+}
+
+void* resumer(void *arg){
+	void *value;
+	while(1){
+		if(fiber_resume(shared, &value)){
+			seen[(intptr_t) value]++;
+		}else if(errno == EBUSY){
+			sched_yield();
+		}else{
+			break;
+		}
+	}
+	__atomic_fetch_add(&finished, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+void* ping(void *arg){
+	for(int i = 0; i < PING_PONG_CNT; i++){
+		if(turn != 0){
+			printf("Error, ping ran out of turn\n");
+			exit(-1);
+		}
+		pings++;
+		turn = 1;
+		fiber_switch_to(ponger);
+	}
+	return NULL;
+}
+
+void* pong(void *arg){
+	while(1){
+		if(turn != 1){
+			printf("Error, pong ran out of turn\n");
+			exit(-1);
+		}
+		pongs++;
+		turn = 0;
+		fiber_switch_to(pinger);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	fiber_t fiber;
+	void *value;
+
+	// A generator hands its values over one by one, then its return value
+	fiber_create(&fiber, &generator, NULL);
+	for(intptr_t i = 0; i < GENERATED_CNT; i++){
+		if(!fiber_resume(fiber, &value) || (intptr_t) value != i){
+			printf("Error, generator yielded the wrong value\n");
+			exit(-1);
+		}
+	}
+	if(fiber_resume(fiber, &value) || (intptr_t) value != -1){
+		printf("Error, generator did not return its value\n");
+		exit(-1);
+	}
+	if(fiber_resume(fiber, &value)){
+		printf("Error, finished fiber could be resumed\n");
+		exit(-1);
+	}
+	printf("generator yielded %d values\n", GENERATED_CNT);
+
+	// Finished fibers give their slot back, so this is more than the thread table holds
+	for(int i = 0; i < FIBER_CNT; i++){
+		if(fiber_create(&fiber, &generator, NULL) != 0){
+			printf("Error, fiber %d could not be created\n", i);
+			exit(-1);
+		}
+		while(fiber_resume(fiber, &value)){
+		}
+	}
+	printf("ran %d fibers to the end\n", FIBER_CNT);
+
+	// Two fibers switching straight to each other. ping falls back to main when it returns
+	fiber_create(&pinger, &ping, NULL);
+	fiber_create(&ponger, &pong, NULL);
+	fiber_switch_to(pinger);
+	if(pings != PING_PONG_CNT || pongs != PING_PONG_CNT || fiber_self() != pthread_self()){
+		printf("Error, ping pong ended with %d pings and %d pongs\n", pings, pongs);
+		exit(-1);
+	}
+	printf("%d pings and %d pongs\n", pings, pongs);
+
+	// Resuming a fiber another thread is running fails instead of jumping onto its live stack
+	pthread_t thread;
+	struct timespec nap = {0, 1000000};
+	fiber_create(&held, &holder, NULL);
+	pthread_create(&thread, NULL, &contender, NULL);
+	if(fiber_resume(held, NULL) || contender_errno != EBUSY){
+		printf("Error, second resume of a running fiber gave %d instead of EBUSY\n", contender_errno);
+		exit(-1);
+	}
+
+	// Several threads racing to resume one generator each get different values
+	fiber_create(&shared, &counter, NULL);
+	for(int i = 0; i < RESUMER_CNT; i++){
+		pthread_create(&thread, NULL, &resumer, NULL);
+	}
+	while(finished != RESUMER_CNT){
+		nanosleep(&nap, NULL);
+	}
+	for(int i = 0; i < SHARED_CNT; i++){
+		if(seen[i] != 1){
+			printf("Error, value %d was handed out %d times\n", i, seen[i]);
+			exit(-1);
+		}
+	}
+	printf("%d threads shared %d values\n", RESUMER_CNT, SHARED_CNT);
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<errno.h>
+#include<time.h>
+#include "ec440.h"
+
+#define WAITER_CNT 6
+#define LOCK_THREADS 4
+#define LOCK_ROUNDS 500
+
+// A gate that waiters sleep on until it opens
+int gate;
+int passed;
+
+// A lock built the usual futex way: 0 free, 1 taken, 2 taken with waiters
+int word;
+long counter;
+volatile int finished;
+
+void* waiter(void *arg){
+	while(gate == 0){
+		ec440_wait(&gate, 0);
+	}
+	passed++;
+	finished++;
+	return NULL;
+}
+
+void wordLock(){
+	int seen = __sync_val_compare_and_swap(&word, 0, 1);
+	while(seen != 0){
+		if(seen == 2 || __sync_val_compare_and_swap(&word, 1, 2) != 0){
+			ec440_wait(&word, 2);
+		}
+		seen = __sync_val_compare_and_swap(&word, 0, 2);
+	}
+}
+
+void wordUnlock(){
+	if(__sync_fetch_and_sub(&word, 1) != 1){
+		word = 0;
+		ec440_wake(&word, 1);
+	}
+}
+
+void* locker(void *arg){
+	for(int i = 0; i < LOCK_ROUNDS; i++){
+		wordLock();
+		long seen = counter;
+		sched_yield();
+		counter = seen + 1;
+		wordUnlock();
+	}
+	finished++;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+
+	// A value that already changed does not block
+	if(ec440_wait(&gate, 1) != EAGAIN){
+		printf("Error, ec440_wait() blocked on a value that was not there\n");
+		exit(-1);
+	}
+
+	for(int i = 0; i < WAITER_CNT; i++){
+		pthread_create(&tid, NULL, &waiter, NULL);
+	}
+	struct timespec pause = {0, 10000000};
+	nanosleep(&pause, NULL);
+
+	// Waking a few only lets those through, the rest keep waiting on the closed gate
+	if(ec440_wake(&gate, 2) != 2){
+		printf("Error, ec440_wake() did not wake 2 waiters\n");
+		exit(-1);
+	}
+	nanosleep(&pause, NULL);
+	if(passed != 0){
+		printf("Error, a waiter went through the closed gate\n");
+		exit(-1);
+	}
+	gate = 1;
+	int woken = ec440_wake(&gate, WAITER_CNT);
+	while(finished < WAITER_CNT){
+		sched_yield();
+	}
+	if(woken != WAITER_CNT || ec440_wake(&gate, 1) != 0){
+		printf("Error, %d of %d waiters were woken\n", woken, WAITER_CNT);
+		exit(-1);
+	}
+
+	finished = 0;
+	for(int i = 0; i < LOCK_THREADS; i++){
+		pthread_create(&tid, NULL, &locker, NULL);
+	}
+	while(finished < LOCK_THREADS){
+		sched_yield();
+	}
+	if(counter != LOCK_THREADS * LOCK_ROUNDS){
+		printf("Error, the lock let %ld of %d increments through\n", counter, LOCK_THREADS * LOCK_ROUNDS);
+		exit(-1);
+	}
+	printf("%d waiters passed the gate, %ld increments under a futex lock\n", WAITER_CNT, counter);
+	return 0;
+}
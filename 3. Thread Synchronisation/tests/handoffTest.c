@@ -0,0 +1,65 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<sched.h>
+#include<time.h>
+#include<stdint.h>
+
+#define WAITER_CNT 3
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_t threads[WAITER_CNT + 1];
+intptr_t order[WAITER_CNT + 1];
+volatile int finished;
+
+void* waiter(void *arg){
+	if(pthread_mutex_lock(&mutex) != 0){
+		printf("Error, thread %lx was woken up without the mutex\n", pthread_self());
+		exit(-1);
+	}
+	order[finished++] = (intptr_t) arg;
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+void* timedWaiter(void *arg){
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 5;
+	if(pthread_mutex_timedlock(&mutex, &deadline) != 0){
+		printf("Error, thread %lx timed out on a mutex that was handed to it\n", pthread_self());
+		exit(-1);
+	}
+	order[finished++] = (intptr_t) arg;
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+
+	// Every waiter runs right after it is created and queues up on the mutex
+	pthread_mutex_lock(&mutex);
+	for(intptr_t i = 0; i < WAITER_CNT; i++){
+		pthread_create(&threads[i], NULL, &waiter, (void *) i);
+	}
+	pthread_create(&threads[WAITER_CNT], NULL, &timedWaiter, (void *) WAITER_CNT);
+
+	// Unlocking hands the mutex over but does not give the CPU up
+	pthread_mutex_unlock(&mutex);
+	if(finished != 0){
+		printf("Error, unlocking switched to the waiter\n");
+		exit(-1);
+	}
+
+	while(finished < WAITER_CNT + 1){
+		sched_yield();
+	}
+	for(intptr_t i = 0; i <= WAITER_CNT; i++){
+		if(order[i] != i){
+			printf("Error, the waiters did not get the mutex in the order they asked for it\n");
+			exit(-1);
+		}
+	}
+	printf("%d waiters got the mutex in order\n", WAITER_CNT + 1);
+	return 0;
+}
@@ -0,0 +1,287 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<fcntl.h>
+#include "ec440.h"
+
+#define MESSAGE "ping"
+#define BULK_SIZE (1 << 20)
+#define HERD_CNT 3
+#define IDLE_SWITCHES 5
+
+int pipeFds[2];
+int sockFds[2];
+volatile int pipeDone;
+volatile int sockDone;
+char pipeBuf[16];
+char sockBuf[16];
+char *bulkIn, *bulkOut;
+volatile int bulkDone;
+int herdFds[2];
+volatile int herdDone;
+int duplexFds[2];
+volatile int duplexDone;
+char duplexBuf[16];
+int listener;
+int accepted[2];
+volatile int acceptDone;
+
+void* pipeReader(void *arg){
+	// Blocks only this thread until main writes to the pipe
+	ssize_t n = read(pipeFds[0], pipeBuf, sizeof(pipeBuf));
+	printf("thread %lx read %zd bytes from the pipe\n", pthread_self(), n);
+	pipeDone = 1;
+	return NULL;
+}
+
+void* bulkReader(void *arg){
+	size_t got = 0;
+	while(got < BULK_SIZE){
+		ssize_t n = read(pipeFds[0], bulkIn + got, BULK_SIZE - got);
+		if(n <= 0){
+			break;
+		}
+		got += n;
+	}
+	bulkDone = 1;
+	return NULL;
+}
+
+void* herdReader(void *arg){
+	char c;
+	if(read(herdFds[0], &c, 1) != 1){
+		printf("Error, a reader sharing the pipe got nothing\n");
+		exit(-1);
+	}
+	herdDone++;
+	return NULL;
+}
+
+void* duplexReader(void *arg){
+	recv(duplexFds[0], duplexBuf, sizeof(duplexBuf), 0);
+	duplexDone++;
+	return NULL;
+}
+
+void* duplexWriter(void *arg){
+	if(send(duplexFds[0], bulkOut, BULK_SIZE, 0) != BULK_SIZE){
+		printf("Error, the send sharing the socket returned early\n");
+		exit(-1);
+	}
+	duplexDone++;
+	return NULL;
+}
+
+// Fail if any of the threads was switched to while they should all sit in epoll
+void check_idle(pthread_t *tids, int n, const char *what){
+	uint64_t before[n];
+	ec440_thread_stats_t stats;
+	for(int i = 0; i < n; i++){
+		ec440_thread_stats(tids[i], &stats);
+		before[i] = stats.switches;
+	}
+	usleep(100000);
+	for(int i = 0; i < n; i++){
+		ec440_thread_stats(tids[i], &stats);
+		if(stats.switches - before[i] > IDLE_SWITCHES){
+			printf("Error, %s ran %lu times while waiting\n", what, stats.switches - before[i]);
+			exit(-1);
+		}
+	}
+}
+
+void* acceptor(void *arg){
+	int *slot = arg;
+	*slot = accept(listener, NULL, NULL);
+	if(*slot == -1){
+		perror("accept");
+	}
+	acceptDone++;
+	return NULL;
+}
+
+void* sockEcho(void *arg){
+	char buf[16];
+	ssize_t n = recv(sockFds[1], buf, sizeof(buf), 0);
+	printf("thread %lx echoing %zd bytes\n", pthread_self(), n);
+	send(sockFds[1], buf, n, 0);
+	return NULL;
+}
+
+void* sockClient(void *arg){
+	send(sockFds[0], MESSAGE, sizeof(MESSAGE), 0);
+	ssize_t n = recv(sockFds[0], sockBuf, sizeof(sockBuf), 0);
+	printf("thread %lx got %zd bytes back\n", pthread_self(), n);
+	sockDone = 1;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+	if(pipe(pipeFds) != 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, sockFds) != 0){
+		printf("Error, could not create the pipe and sockets\n");
+		exit(-1);
+	}
+
+	// If the read blocked the kernel thread, main would never get past here
+	pthread_create(&tid, NULL, &pipeReader, NULL);
+	usleep(100000);
+	if(pipeDone){
+		printf("Error, the reader finished before anything was written\n");
+		exit(-1);
+	}
+	write(pipeFds[1], MESSAGE, sizeof(MESSAGE));
+	while(!pipeDone){
+		usleep(1000);
+	}
+	if(strcmp(pipeBuf, MESSAGE) != 0){
+		printf("Error, the reader got the wrong data\n");
+		exit(-1);
+	}
+
+	// Far more than the pipe holds, so the write has to wait for the reader more than once
+	bulkIn = malloc(BULK_SIZE);
+	bulkOut = malloc(BULK_SIZE);
+	for(int i = 0; i < BULK_SIZE; i++){
+		bulkOut[i] = i * 7;
+	}
+	pthread_create(&tid, NULL, &bulkReader, NULL);
+	if(write(pipeFds[1], bulkOut, BULK_SIZE) != BULK_SIZE){
+		printf("Error, the write returned before everything was written\n");
+		exit(-1);
+	}
+	while(!bulkDone){
+		usleep(1000);
+	}
+	if(memcmp(bulkIn, bulkOut, BULK_SIZE) != 0){
+		printf("Error, the reader got the wrong bulk data\n");
+		exit(-1);
+	}
+	printf("wrote %d bytes through the pipe\n", BULK_SIZE);
+
+	// Several readers wait on one pipe. They share its epoll registration instead of polling
+	pthread_t herd[HERD_CNT];
+	pipe(herdFds);
+	for(int i = 0; i < HERD_CNT; i++){
+		pthread_create(&herd[i], NULL, &herdReader, NULL);
+	}
+	usleep(10000);
+	check_idle(herd, HERD_CNT, "a reader sharing the pipe");
+	for(int i = 0; i < HERD_CNT; i++){
+		write(herdFds[1], "x", 1);
+	}
+	while(herdDone < HERD_CNT){
+		usleep(1000);
+	}
+	printf("%d readers shared a pipe\n", HERD_CNT);
+
+	// A reader and a writer wait on the same socket, for different events
+	pthread_t duplex[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, duplexFds);
+	pthread_create(&duplex[0], NULL, &duplexReader, NULL);
+	pthread_create(&duplex[1], NULL, &duplexWriter, NULL);
+	usleep(10000);
+	check_idle(duplex, 2, "a thread sharing the socket");
+	send(duplexFds[1], MESSAGE, sizeof(MESSAGE), 0);
+	while(duplexDone < 1){
+		usleep(1000);
+	}
+	if(strcmp(duplexBuf, MESSAGE) != 0){
+		printf("Error, the reader sharing the socket got the wrong data\n");
+		exit(-1);
+	}
+	size_t got = 0;
+	while(got < BULK_SIZE){
+		ssize_t n = recv(duplexFds[1], bulkIn + got, BULK_SIZE - got, 0);
+		if(n <= 0){
+			break;
+		}
+		got += n;
+	}
+	while(duplexDone < 2){
+		usleep(1000);
+	}
+	if(got != BULK_SIZE || memcmp(bulkIn, bulkOut, BULK_SIZE) != 0){
+		printf("Error, the writer sharing the socket sent the wrong data\n");
+		exit(-1);
+	}
+	printf("a reader and a writer shared a socket\n");
+
+	// connect() waits in epoll, but the socket stays in blocking mode for everyone else
+	struct sockaddr_in local = {AF_INET, 0, {htonl(INADDR_LOOPBACK)}};
+	socklen_t len = sizeof(local);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	int client = socket(AF_INET, SOCK_STREAM, 0);
+	if(bind(listener, (struct sockaddr *) &local, len) != 0 || listen(listener, 1) != 0
+		|| getsockname(listener, (struct sockaddr *) &local, &len) != 0
+		|| connect(client, (struct sockaddr *) &local, len) != 0){
+		printf("Error, could not connect over loopback\n");
+		exit(-1);
+	}
+	if(fcntl(client, F_GETFL) & O_NONBLOCK){
+		printf("Error, connect left the socket in O_NONBLOCK mode\n");
+		exit(-1);
+	}
+	close(client);
+	close(listener);
+
+	// Two threads accept on one listener. Each connection wakes one of them, and neither may
+	// end up in a blocking accept() that the quantum timer interrupts with EINTR
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	local.sin_port = 0;
+	len = sizeof(local);
+	if(bind(listener, (struct sockaddr *) &local, len) != 0 || listen(listener, 2) != 0
+		|| getsockname(listener, (struct sockaddr *) &local, &len) != 0){
+		printf("Error, could not listen on loopback\n");
+		exit(-1);
+	}
+	for(int i = 0; i < 2; i++){
+		pthread_create(&tid, NULL, &acceptor, &accepted[i]);
+	}
+	usleep(100000);
+	int clients[2];
+	for(int i = 0; i < 2; i++){
+		clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+		if(connect(clients[i], (struct sockaddr *) &local, len) != 0){
+			printf("Error, could not connect to the shared listener\n");
+			exit(-1);
+		}
+		// Long enough for several quantum timer ticks to land while the other thread still waits
+		usleep(100000);
+	}
+	while(acceptDone < 2){
+		usleep(1000);
+	}
+	for(int i = 0; i < 2; i++){
+		if(accepted[i] < 0){
+			printf("Error, acceptor %d failed\n", i);
+			exit(-1);
+		}
+		if(fcntl(accepted[i], F_GETFL) & O_NONBLOCK){
+			printf("Error, an accepted socket was left in O_NONBLOCK mode\n");
+			exit(-1);
+		}
+		close(accepted[i]);
+		close(clients[i]);
+	}
+	close(listener);
+	printf("two threads accepted on one listener\n");
+
+	// The echo thread waits in recv before the client has sent anything
+	pthread_create(&tid, NULL, &sockEcho, NULL);
+	usleep(100000);
+	pthread_create(&tid, NULL, &sockClient, NULL);
+	while(!sockDone){
+		usleep(1000);
+	}
+	if(strcmp(sockBuf, MESSAGE) != 0){
+		printf("Error, the echo came back wrong\n");
+		exit(-1);
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<sched.h>
+#include<errno.h>
+#include<stdint.h>
+
+#define THREAD_CNT 4
+#define EXTRA_KEYS 40
+
+pthread_t threads[THREAD_CNT];
+pthread_key_t key;
+pthread_key_t extraKeys[EXTRA_KEYS];
+int destroyed;
+
+void destructor(void *value){
+	destroyed++;
+}
+
+void* keyTest(void *arg){
+	intptr_t id = (intptr_t) arg;
+
+	// Past the slots kept in the TCB too
+	pthread_setspecific(key, (void *) id);
+	pthread_setspecific(extraKeys[EXTRA_KEYS - 1], (void *) (id + 100));
+	errno = (int) id;
+
+	for(int i = 0; i < 3; i++){
+		sched_yield();
+		if((intptr_t) pthread_getspecific(key) != id || (intptr_t) pthread_getspecific(extraKeys[EXTRA_KEYS - 1]) != id + 100){
+			printf("Error, thread %lx sees another thread's value\n", pthread_self());
+			exit(-1);
+		}
+		if(errno != id){
+			printf("Error, thread %lx sees another thread's errno\n", pthread_self());
+			exit(-1);
+		}
+	}
+	printf("thread %lx kept its values\n", pthread_self());
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_key_create(&key, &destructor);
+	for(int i = 0; i < EXTRA_KEYS; i++){
+		pthread_key_create(&extraKeys[i], NULL);
+	}
+
+	for(intptr_t i = 0; i < THREAD_CNT; i++){
+		pthread_create(&threads[i], NULL, &keyTest, (void *)(i + 1));
+	}
+	while(destroyed < THREAD_CNT){
+		sched_yield();
+	}
+
+	if(pthread_getspecific(key) != NULL){
+		printf("Error, main sees a value it never set\n");
+		exit(-1);
+	}
+
+	// A key that is deleted and created again starts out empty
+	pthread_setspecific(key, &key);
+	pthread_key_delete(key);
+	pthread_key_create(&key, NULL);
+	if(pthread_getspecific(key) != NULL){
+		printf("Error, a new key kept the value of a deleted one\n");
+		exit(-1);
+	}
+	printf("%d destructors ran\n", destroyed);
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<sched.h>
+#include<unistd.h>
+#include<sys/wait.h>
+
+#define LOCKSTAT_FILE "lockstatTest.report"
+#define THREAD_CNT 4
+#define HOT_ROUNDS 200
+#define COLD_ROUNDS 1000
+
+pthread_mutex_t hot;
+pthread_mutex_t coldMutex = PTHREAD_MUTEX_INITIALIZER;
+volatile int finished;
+
+// The site the report should blame: every thread yields while holding the mutex
+void hotInit(){
+	pthread_mutex_init(&hot, NULL);
+}
+
+void* worker(void *arg){
+	for(int i = 0; i < HOT_ROUNDS; i++){
+		pthread_mutex_lock(&hot);
+		sched_yield();
+		pthread_mutex_unlock(&hot);
+	}
+	for(int i = 0; i < COLD_ROUNDS; i++){
+		pthread_mutex_lock(&coldMutex);
+		pthread_mutex_unlock(&coldMutex);
+	}
+	finished++;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	// The report is only written when the process exits, so count in a child
+	pid_t child = fork();
+	if(child == 0){
+		setenv("EC440_LOCKSTAT", LOCKSTAT_FILE, 1);
+		hotInit();
+		pthread_t tid;
+		for(int i = 0; i < THREAD_CNT; i++){
+			pthread_create(&tid, NULL, &worker, NULL);
+		}
+		while(finished < THREAD_CNT){
+			sched_yield();
+		}
+		exit(0);
+	}
+	int status;
+	waitpid(child, &status, 0);
+
+	FILE *report = fopen(LOCKSTAT_FILE, "r");
+	if(report == NULL){
+		printf("Error, the report was not written\n");
+		exit(-1);
+	}
+
+	// The header, then the most waited for site first
+	char line[512], site[256], address[64];
+	unsigned long mutexes, acquired, contended;
+	if(fgets(line, sizeof(line), report) == NULL || fgets(line, sizeof(line), report) == NULL ||
+		sscanf(line, "%255s %63s %lu %lu %lu", site, address, &mutexes, &acquired, &contended) != 5){
+		printf("Error, the report has no sites\n");
+		exit(-1);
+	}
+	if(strcmp(site, "hotInit") != 0 || acquired != THREAD_CNT * HOT_ROUNDS || contended == 0){
+		printf("Error, the hottest site is %s with %lu acquisitions, %lu contended\n", site, acquired, contended);
+		exit(-1);
+	}
+	int foundCold = 0;
+	while(fgets(line, sizeof(line), report) != NULL){
+		if(sscanf(line, "%255s %63s %lu %lu", site, address, &mutexes, &acquired) == 4 && strcmp(site, "coldMutex") == 0){
+			foundCold = (acquired == THREAD_CNT * COLD_ROUNDS);
+		}
+	}
+	fclose(report);
+	remove(LOCKSTAT_FILE);
+
+	if(!foundCold){
+		printf("Error, the statically initialised mutex is missing from the report\n");
+		exit(-1);
+	}
+	printf("hotInit blamed for the contention, coldMutex counted by name\n");
+	return 0;
+}
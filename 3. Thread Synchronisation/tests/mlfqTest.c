@@ -0,0 +1,178 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<time.h>
+#include<stdbool.h>
+#include "ec440.h"
+
+#define QUANTUM_USECS "5000"
+#define TOP_LEVEL 3
+#define SPIN_USECS 100000
+#define SLEEP_CNT 20
+#define STARVE_USECS 1000000
+#define BURST_USECS 1500
+
+volatile int stop;
+volatile int finished;
+volatile int spinnerMax;
+volatile int phaseMax;
+volatile int phaseLevel;
+volatile int sleeperMax;
+volatile int sleeperLevel;
+volatile int sleeperRounds;
+volatile long starvedProgress;
+
+int level(){
+	ec440_thread_stats_t stats;
+	ec440_thread_stats(pthread_self(), &stats);
+	return stats.level;
+}
+
+long usecs_now(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+void spin_for(long usecs){
+	long end = usecs_now() + usecs;
+	while(usecs_now() < end);
+}
+
+// Uses up every quantum it gets, so that the timer keeps running and the others get preempted
+void* spinner(void *arg){
+	while(!stop){
+		int now = level();
+		if(now > spinnerMax){
+			spinnerMax = now;
+		}
+	}
+	finished++;
+	return NULL;
+}
+
+// CPU-bound first, then sleeps right after every short burst
+void* phase(void *arg){
+	long end = usecs_now() + SPIN_USECS;
+	while(usecs_now() < end){
+		int now = level();
+		if(now > phaseMax){
+			phaseMax = now;
+		}
+	}
+	for(int i = 0; i < SLEEP_CNT; i++){
+		usleep(1000);
+	}
+	phaseLevel = level();
+	finished++;
+	return NULL;
+}
+
+// Blocks long before its quantum runs out, every time
+void* sleeper(void *arg){
+	while(!stop){
+		int now = level();
+		if(now > sleeperMax){
+			sleeperMax = now;
+		}
+		usleep(1000);
+		sleeperRounds++;
+	}
+	sleeperLevel = level();
+	finished++;
+	return NULL;
+}
+
+// Runs a short burst and sleeps, so that it keeps its level and gets ahead of the CPU-bound threads
+void* interactive(void *arg){
+	while(!stop){
+		spin_for(BURST_USECS);
+		usleep(1);
+	}
+	finished++;
+	return NULL;
+}
+
+// Sinks below the interactive thread, and is lifted again by the boosts
+void* starved(void *arg){
+	while(!stop){
+		starvedProgress++;
+	}
+	finished++;
+	return NULL;
+}
+
+void wait_finished(int count){
+	while(finished < count){
+		usleep(1000);
+	}
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+
+	// Read when the library starts up with the first thread. With a single worker the CPU-bound
+	// threads always compete for it, so the quantum timer keeps running
+	setenv("EC440_SCHED_POLICY", "mlfq", 1);
+	setenv("EC440_QUANTUM_USECS", QUANTUM_USECS, 1);
+	setenv("EC440_WORKERS", "1", 1);
+
+	// A thread that uses its whole quantum moves down, and one that blocks early moves back up
+	pthread_create(&tid, NULL, &spinner, NULL);
+	pthread_create(&tid, NULL, &phase, NULL);
+	pthread_create(&tid, NULL, &sleeper, NULL);
+	while(finished < 1){
+		usleep(1000);
+	}
+	stop = 1;
+	wait_finished(3);
+	if(spinnerMax <= TOP_LEVEL || phaseMax <= TOP_LEVEL){
+		printf("Error, CPU-bound threads stayed at levels %d and %d\n", spinnerMax, phaseMax);
+		exit(-1);
+	}
+	if(phaseLevel != TOP_LEVEL){
+		printf("Error, a thread that sleeps after every burst stayed at level %d\n", phaseLevel);
+		exit(-1);
+	}
+	if(sleeperMax > TOP_LEVEL + 1 || sleeperLevel != TOP_LEVEL || sleeperRounds < SLEEP_CNT){
+		printf("Error, a thread that always sleeps reached level %d, ended at %d after %d rounds\n",
+			sleeperMax, sleeperLevel, sleeperRounds);
+		exit(-1);
+	}
+	printf("CPU-bound threads sank to level %d, sleepers stayed at %d\n", spinnerMax, sleeperLevel);
+
+	// Two CPU-bound threads sink while an interactive thread keeps getting ahead of them. Every MLFQ_BOOST_TICKS preemptions, the boost lifts them back to the top.
+	// main sleeps too, and looks at the level of one of them every time it wakes up
+	stop = 0;
+	finished = 0;
+	pthread_t victim;
+	pthread_create(&victim, NULL, &starved, NULL);
+	pthread_create(&tid, NULL, &spinner, NULL);
+	pthread_create(&tid, NULL, &interactive, NULL);
+	bool sank = false, boosted = false;
+	long progress = 0;
+	for(long start = usecs_now(); usecs_now() - start < STARVE_USECS && !boosted; usleep(1000)){
+		ec440_thread_stats_t stats;
+		ec440_thread_stats(victim, &stats);
+		if(stats.level > TOP_LEVEL && !sank){
+			sank = true;
+			progress = starvedProgress;
+		}
+		else if(stats.level == TOP_LEVEL && sank){
+			boosted = true;
+		}
+	}
+	// Once lifted, it gets the CPU again
+	while(boosted && starvedProgress == progress && !stop){
+		usleep(1000);
+	}
+	stop = 1;
+	wait_finished(3);
+	if(!sank || !boosted){
+		printf("Error, the CPU-bound thread %s\n", sank ? "was never boosted" : "never sank");
+		exit(-1);
+	}
+	printf("boosts kept the CPU-bound thread going\n");
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<unistd.h>
+
+#define BATCH_CNT 3
+#define COUNTER_FACTOR 0xFFFFFF
+#define URGENT_PRIORITY 10
+
+pthread_t threads[BATCH_CNT + 1];
+char order[BATCH_CNT + 1];
+int finished;
+volatile int lateRan;
+
+void wasteTime(int a){
+	for(long int i = 0; i < a*COUNTER_FACTOR; i++);
+}
+
+void* batch(void *arg){
+	wasteTime(3);
+	order[finished++] = 'b';
+	printf("batch thread %lx finish\n", pthread_self());
+	return NULL;
+}
+
+void* urgent(void *arg){
+	wasteTime(3);
+	order[finished++] = 'u';
+	printf("urgent thread %lx finish\n", pthread_self());
+	return NULL;
+}
+
+void* late(void *arg){
+	lateRan = 1;
+	return NULL;
+}
+
+void createWithPriority(pthread_t *thread, void *(*start_routine) (void *), int priority){
+	pthread_attr_t attr;
+	struct sched_param param;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, priority ? SCHED_RR : SCHED_OTHER);
+	param.sched_priority = priority;
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_create(thread, &attr, start_routine, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+int main(int argc, char **argv) {
+	// Priorities order the ready queues of one worker. With more workers the batch threads
+	// run next to the urgent one, so the order checked here only holds on a single worker
+	setenv("EC440_WORKERS", "1", 1);
+
+	// Stay on the CPU while creating the other threads
+	pthread_setschedprio(pthread_self(), URGENT_PRIORITY);
+
+	for (int i = 0; i < BATCH_CNT; i++) {
+		createWithPriority(&threads[i], &batch, 0);
+	}
+	createWithPriority(&threads[BATCH_CNT], &urgent, URGENT_PRIORITY);
+
+	// Drop back to the batch threads' priority
+	pthread_setschedprio(pthread_self(), 0);
+	wasteTime(20);
+
+	if(finished != BATCH_CNT + 1){
+		printf("Error, only %d threads finished\n", finished);
+		exit(-1);
+	}
+	if(order[0] != 'u'){
+		printf("Error, the urgent thread did not run ahead of the batch threads\n");
+		exit(-1);
+	}
+
+	// A thread waiting in the ready queue moves up as soon as its priority is raised
+	pthread_t lateThread;
+	pthread_setschedprio(pthread_self(), 1);
+	createWithPriority(&lateThread, &late, 0);
+	pthread_setschedprio(lateThread, 2);
+	wasteTime(1);
+	if(!lateRan){
+		printf("Error, raising the priority of a ready thread did not let it run\n");
+		exit(-1);
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<time.h>
+#include<sys/wait.h>
+
+#define PROFILE_FILE "profileTest.folded"
+#define SPIN_MSECS 300
+
+volatile int done;
+
+// Burn CPU time, so that the profiler's timer goes off while the thread runs. The clock is
+// only read now and then, so that nearly all samples land in spin itself
+void spin(){
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do{
+		for(volatile int i = 0; i < 100000; i++);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	}while((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 < SPIN_MSECS);
+}
+
+void* spinA(void *arg){
+	spin();
+	done++;
+	return NULL;
+}
+
+void* spinB(void *arg){
+	spin();
+	done++;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	// The profile is only written when the process exits, so profile a child
+	pid_t child = fork();
+	if(child == 0){
+		setenv("EC440_PROFILE", PROFILE_FILE, 1);
+		pthread_t threads[2];
+		pthread_create(&threads[0], NULL, &spinA, NULL);
+		pthread_create(&threads[1], NULL, &spinB, NULL);
+		while(done < 2){
+			sched_yield();
+		}
+		exit(0);
+	}
+	int status;
+	waitpid(child, &status, 0);
+
+	FILE *profile = fopen(PROFILE_FILE, "r");
+	if(profile == NULL){
+		printf("Error, the profile was not written\n");
+		exit(-1);
+	}
+
+	// Every stack starts with the thread it was sampled in, then unwinds to the entry of that thread
+	char line[4096];
+	int foundA = 0, foundB = 0;
+	while(fgets(line, sizeof(line), profile) != NULL){
+		if(strstr(line, ";spinA;spin") != NULL){
+			if(strncmp(line, "thread_1;thread_entry;spinA", strlen("thread_1;thread_entry;spinA")) != 0){
+				printf("Error, spinA sampled as %s", line);
+				exit(-1);
+			}
+			foundA = 1;
+		}
+		if(strstr(line, ";spinB;spin") != NULL){
+			if(strncmp(line, "thread_2;thread_entry;spinB", strlen("thread_2;thread_entry;spinB")) != 0){
+				printf("Error, spinB sampled as %s", line);
+				exit(-1);
+			}
+			foundB = 1;
+		}
+	}
+	fclose(profile);
+	remove(PROFILE_FILE);
+
+	if(!foundA || !foundB){
+		printf("Error, the profile is missing spinA or spinB\n");
+		exit(-1);
+	}
+	printf("both threads were sampled in their own stacks\n");
+	return 0;
+}
@@ -0,0 +1,228 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<sched.h>
+#include<stddef.h>
+#include<unistd.h>
+#include<sys/wait.h>
+#include<time.h>
+#include "ec440.h"
+
+#define READER_CNT 4
+#define UPDATE_CNT 20
+#define ROUTES 16
+#define ALIVE 0x600D
+#define DEAD 0xDEAD
+#define FEW_CALLBACKS 3
+#define QUICK_CNT 1000
+#define QUICK_USECS 100000
+#define HOLD_USECS 20000
+#define WAIT_SWITCHES 5
+#define TAKE_USECS 2000
+
+// A routing table that readers use without a lock and the updater replaces whole
+typedef struct{
+	int magic;
+	int routes[ROUTES];
+	struct rcu_head rcu;
+}table;
+
+table *routing;
+volatile int stop;
+volatile int finished;
+int callbacks;
+int exitPipe[2];
+volatile int holding;
+volatile int updating;
+
+// Old tables are only marked, never freed, so a reader that still held one would see DEAD
+void retire(table *old){
+	old->magic = DEAD;
+}
+
+void retireCallback(struct rcu_head *head){
+	retire((table *) ((char *) head - offsetof(table, rcu)));
+	callbacks++;
+}
+
+void countCallback(struct rcu_head *head){
+	callbacks++;
+}
+
+void slowCallback(struct rcu_head *head){
+	usleep(1000);
+	callbacks++;
+}
+
+void exitCallback(struct rcu_head *head){
+	write(exitPipe[1], "x", 1);
+}
+
+void* reader(void *arg){
+	while(!stop){
+		rcu_read_lock();
+		table *current = rcu_dereference(routing);
+		for(int i = 0; i < ROUTES; i++){
+			// Give the CPU up inside the critical section, so that updates happen meanwhile
+			if(i == ROUTES / 2){
+				sched_yield();
+			}
+			if(current->magic != ALIVE || current->routes[i] != current->routes[0]){
+				printf("Error, thread %lx read a table that was already retired\n", pthread_self());
+				exit(-1);
+			}
+		}
+		rcu_read_unlock();
+	}
+	finished++;
+	return NULL;
+}
+
+// Sleeps inside a critical section, holding up any grace period that starts meanwhile
+void* holder(void *arg){
+	rcu_read_lock();
+	holding = 1;
+	usleep(HOLD_USECS);
+	rcu_read_unlock();
+	finished++;
+	return NULL;
+}
+
+// Takes the queued callbacks off for its grace period, which the holder keeps from ending
+void* updater(void *arg){
+	updating = 1;
+	synchronize_rcu();
+	finished++;
+	return NULL;
+}
+
+long usecs_now(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv) {
+	pthread_t threads[READER_CNT];
+
+	routing = calloc(1, sizeof(table));
+	routing->magic = ALIVE;
+	for(int i = 0; i < READER_CNT; i++){
+		pthread_create(&threads[i], NULL, &reader, NULL);
+	}
+
+	int queued = 0;
+	for(int update = 1; update <= UPDATE_CNT; update++){
+		table *next = calloc(1, sizeof(table));
+		next->magic = ALIVE;
+		for(int i = 0; i < ROUTES; i++){
+			next->routes[i] = update;
+		}
+		table *old = routing;
+		rcu_assign_pointer(routing, next);
+
+		// Half the tables are retired right after a grace period, half through call_rcu()
+		if(update % 2){
+			synchronize_rcu();
+			retire(old);
+		}
+		else{
+			call_rcu(&old->rcu, &retireCallback);
+			queued++;
+		}
+		sched_yield();
+	}
+	rcu_barrier();
+	if(callbacks != queued){
+		printf("Error, %d of %d call_rcu() callbacks ran\n", callbacks, queued);
+		exit(-1);
+	}
+
+	stop = 1;
+	while(finished < READER_CNT){
+		sched_yield();
+	}
+	printf("%d tables replaced under %d readers\n", UPDATE_CNT, READER_CNT);
+
+	// With every reader outside its critical section, a grace period does not wait for a tick
+	long start = usecs_now();
+	for(int i = 0; i < QUICK_CNT; i++){
+		synchronize_rcu();
+	}
+	if(usecs_now() - start > QUICK_USECS){
+		printf("Error, %d grace periods without readers took %ld us\n", QUICK_CNT, usecs_now() - start);
+		exit(-1);
+	}
+
+	// An updater waiting for a reader sleeps until the reader leaves, instead of polling
+	pthread_t tid;
+	ec440_thread_stats_t before, after;
+	finished = 0;
+	pthread_create(&tid, NULL, &holder, NULL);
+	while(!holding){
+		sched_yield();
+	}
+	ec440_thread_stats(pthread_self(), &before);
+	synchronize_rcu();
+	ec440_thread_stats(pthread_self(), &after);
+	if(!finished || after.switches - before.switches > WAIT_SWITCHES){
+		printf("Error, synchronize_rcu() ran %lu times while a reader held it up\n", after.switches - before.switches);
+		exit(-1);
+	}
+	printf("%d grace periods without readers, and one woken by its reader\n", QUICK_CNT);
+
+	// A batch far from full still runs after the next grace period
+	struct rcu_head heads[FEW_CALLBACKS];
+	callbacks = 0;
+	for(int i = 0; i < FEW_CALLBACKS; i++){
+		call_rcu(&heads[i], &countCallback);
+	}
+	synchronize_rcu();
+	if(callbacks != FEW_CALLBACKS){
+		printf("Error, %d of %d callbacks ran after synchronize_rcu()\n", callbacks, FEW_CALLBACKS);
+		exit(-1);
+	}
+
+	// rcu_barrier() also waits for a batch another thread took off the queue and has not run yet
+	struct rcu_head slowHeads[FEW_CALLBACKS];
+	callbacks = 0;
+	finished = 0;
+	holding = 0;
+	pthread_create(&tid, NULL, &holder, NULL);
+	while(!holding){
+		sched_yield();
+	}
+	for(int i = 0; i < FEW_CALLBACKS; i++){
+		call_rcu(&slowHeads[i], &slowCallback);
+	}
+	pthread_create(&tid, NULL, &updater, NULL);
+	while(!updating){
+		sched_yield();
+	}
+	usleep(TAKE_USECS);
+	rcu_barrier();
+	if(callbacks != FEW_CALLBACKS){
+		printf("Error, rcu_barrier() returned after %d of %d callbacks taken by another thread\n", callbacks, FEW_CALLBACKS);
+		exit(-1);
+	}
+	printf("rcu_barrier() waited for a batch taken by another thread\n");
+
+	// Or when the program ends
+	pipe(exitPipe);
+	fflush(stdout);
+	pid_t child = fork();
+	if(child == 0){
+		static struct rcu_head head;
+		call_rcu(&head, &exitCallback);
+		exit(0);
+	}
+	close(exitPipe[1]);
+	char c;
+	if(read(exitPipe[0], &c, 1) != 1){
+		printf("Error, the callback queued before exit never ran\n");
+		exit(-1);
+	}
+	waitpid(child, NULL, 0);
+	printf("%d callbacks ran after synchronize_rcu() and 1 at exit\n", FEW_CALLBACKS);
+	return 0;
+}
@@ -1,27 +1,34 @@
 #!/bin/bash
 TIMEOUT_SECONDS=7
 
+# The suite runs as configured by the caller, then once more on four kernel workers
+# so that every test also sees green threads running in parallel
+passes=( "" "EC440_WORKERS=4" )
+
 all_tests=( "$@" )
-test_count=$#
+test_count=$(( $# * ${#passes[@]} ))
 fail_count=0
 
-for test_file in "${all_tests[@]}"
+for pass in "${passes[@]}"
 do
-	printf "\033[1;39m===== %s =====\033[0m\n" "${test_file}"
-	rm -f testfs # Tidy up from previous tests
-	timeout ${TIMEOUT_SECONDS} "${test_file}"
-	rc=$?
-	if [ ${rc} -eq 0 ]
-	then
-		printf "\033[1;32mPASS\033[0m\n"
-	elif [ ${rc} -eq 124 ]
-	then
-		printf "\033[1;31mFAIL (%d second timeout)\033[0m\n" "${TIMEOUT_SECONDS}"
-		fail_count=$((fail_count + 1))
-	else
-		printf "\033[1;31mFAIL (rc = %d)\033[0m\n" "${rc}"
-		fail_count=$((fail_count + 1))
-	fi
+	for test_file in "${all_tests[@]}"
+	do
+		printf "\033[1;39m===== %s %s=====\033[0m\n" "${test_file}" "${pass:+(${pass}) }"
+		rm -f testfs # Tidy up from previous tests
+		env ${pass} timeout ${TIMEOUT_SECONDS} "${test_file}"
+		rc=$?
+		if [ ${rc} -eq 0 ]
+		then
+			printf "\033[1;32mPASS\033[0m\n"
+		elif [ ${rc} -eq 124 ]
+		then
+			printf "\033[1;31mFAIL (%d second timeout)\033[0m\n" "${TIMEOUT_SECONDS}"
+			fail_count=$((fail_count + 1))
+		else
+			printf "\033[1;31mFAIL (rc = %d)\033[0m\n" "${rc}"
+			fail_count=$((fail_count + 1))
+		fi
+	done
 done
 
 printf "\n%d out of %d tests failed.\n" "${fail_count}" "${test_count}"
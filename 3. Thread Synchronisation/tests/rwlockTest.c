@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<errno.h>
+#include<sched.h>
+#include<time.h>
+
+#define READER_CNT 6
+#define WRITER_CNT 2
+#define ROUNDS 200
+#define ENTRIES 16
+
+// A cache that readers scan with each other, and writers rewrite alone
+pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+int cache[ENTRIES];
+int readersInside, maxReadersInside, writersInside;
+volatile int finished;
+
+void* reader(void *arg){
+	for(int round = 0; round < ROUNDS; round++){
+		pthread_rwlock_rdlock(&rwlock);
+		if(writersInside != 0){
+			printf("Error, a reader got in while a writer held the lock\n");
+			exit(-1);
+		}
+		readersInside++;
+		if(readersInside > maxReadersInside){
+			maxReadersInside = readersInside;
+		}
+
+		// Give the CPU up halfway through, so that other readers come in meanwhile
+		for(int i = 0; i < ENTRIES; i++){
+			if(i == ENTRIES / 2){
+				sched_yield();
+			}
+			if(cache[i] != cache[0]){
+				printf("Error, a reader saw a half-written cache\n");
+				exit(-1);
+			}
+		}
+		readersInside--;
+		pthread_rwlock_unlock(&rwlock);
+	}
+	finished++;
+	return NULL;
+}
+
+void* writer(void *arg){
+	for(int round = 0; round < ROUNDS / 4; round++){
+		pthread_rwlock_wrlock(&rwlock);
+		if(readersInside != 0 || writersInside != 0){
+			printf("Error, a writer got in while the lock was held\n");
+			exit(-1);
+		}
+		writersInside++;
+		for(int i = 0; i < ENTRIES; i++){
+			cache[i]++;
+			if(i == ENTRIES / 2){
+				sched_yield();
+			}
+		}
+		writersInside--;
+		pthread_rwlock_unlock(&rwlock);
+		sched_yield();
+	}
+	finished++;
+	return NULL;
+}
+
+void* blockedWriter(void *arg){
+	pthread_rwlock_wrlock(&rwlock);
+	pthread_rwlock_unlock(&rwlock);
+	finished++;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+
+	// A waiting writer keeps new readers out
+	pthread_rwlock_rdlock(&rwlock);
+	pthread_create(&tid, NULL, &blockedWriter, NULL);
+	struct timespec pause = {0, 10000000};
+	nanosleep(&pause, NULL);
+	if(finished != 0 || pthread_rwlock_tryrdlock(&rwlock) != EBUSY || pthread_rwlock_trywrlock(&rwlock) != EBUSY){
+		printf("Error, the lock did not prefer the waiting writer\n");
+		exit(-1);
+	}
+	pthread_rwlock_unlock(&rwlock);
+	while(finished < 1){
+		sched_yield();
+	}
+	finished = 0;
+
+	for(int i = 0; i < READER_CNT; i++){
+		pthread_create(&tid, NULL, &reader, NULL);
+	}
+	for(int i = 0; i < WRITER_CNT; i++){
+		pthread_create(&tid, NULL, &writer, NULL);
+	}
+	while(finished < READER_CNT + WRITER_CNT){
+		sched_yield();
+	}
+	if(maxReadersInside < 2){
+		printf("Error, readers never held the lock together\n");
+		exit(-1);
+	}
+	if(cache[0] != WRITER_CNT * (ROUNDS / 4) || pthread_rwlock_destroy(&rwlock) != 0){
+		printf("Error, the cache holds %d after %d writes\n", cache[0], WRITER_CNT * (ROUNDS / 4));
+		exit(-1);
+	}
+	printf("up to %d readers shared the lock, %d writes\n", maxReadersInside, cache[0]);
+	return 0;
+}
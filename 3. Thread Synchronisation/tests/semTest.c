@@ -0,0 +1,106 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<errno.h>
+#include<time.h>
+
+#define PRODUCER_CNT 3
+#define CONSUMER_CNT 3
+#define ITEMS 3000
+#define SLOTS 4
+
+// A bounded work queue: one semaphore counts free slots, the other filled ones
+sem_t freeSlots, filledSlots;
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+int queue[SLOTS];
+int head, tail, produced;
+long consumedSum;
+int consumed;
+volatile int finished;
+
+void* producer(void *arg){
+	for(;;){
+		pthread_mutex_lock(&mutex);
+		if(produced == ITEMS){
+			pthread_mutex_unlock(&mutex);
+			break;
+		}
+		int item = ++produced;
+		pthread_mutex_unlock(&mutex);
+
+		sem_wait(&freeSlots);
+		pthread_mutex_lock(&mutex);
+		queue[tail] = item;
+		tail = (tail + 1) % SLOTS;
+		pthread_mutex_unlock(&mutex);
+		sem_post(&filledSlots);
+	}
+	finished++;
+	return NULL;
+}
+
+void* consumer(void *arg){
+	for(int i = 0; i < ITEMS / CONSUMER_CNT; i++){
+		sem_wait(&filledSlots);
+		pthread_mutex_lock(&mutex);
+		consumedSum += queue[head];
+		consumed++;
+		head = (head + 1) % SLOTS;
+		pthread_mutex_unlock(&mutex);
+		sem_post(&freeSlots);
+	}
+	finished++;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+	sem_init(&freeSlots, 0, SLOTS);
+	sem_init(&filledSlots, 0, 0);
+
+	for(int i = 0; i < PRODUCER_CNT; i++){
+		pthread_create(&tid, NULL, &producer, NULL);
+	}
+	for(int i = 0; i < CONSUMER_CNT; i++){
+		pthread_create(&tid, NULL, &consumer, NULL);
+	}
+	while(finished < PRODUCER_CNT + CONSUMER_CNT){
+		sched_yield();
+	}
+	if(consumed != ITEMS || consumedSum != (long) ITEMS * (ITEMS + 1) / 2){
+		printf("Error, consumed %d items with a sum of %ld\n", consumed, consumedSum);
+		exit(-1);
+	}
+
+	// Every slot is free again, and nothing is left to take
+	int value;
+	sem_getvalue(&freeSlots, &value);
+	if(value != SLOTS){
+		printf("Error, %d free slots instead of %d\n", value, SLOTS);
+		exit(-1);
+	}
+	if(sem_trywait(&filledSlots) != -1 || errno != EAGAIN){
+		printf("Error, sem_trywait() took from an empty semaphore\n");
+		exit(-1);
+	}
+
+	// A timed wait on an empty semaphore gives up
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 50000000;
+	if(deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	if(sem_timedwait(&filledSlots, &deadline) != -1 || errno != ETIMEDOUT){
+		printf("Error, the timed wait was not given up\n");
+		exit(-1);
+	}
+	if(sem_destroy(&freeSlots) != 0 || sem_destroy(&filledSlots) != 0){
+		printf("Error, the semaphores could not be destroyed\n");
+		exit(-1);
+	}
+	printf("%d items passed through %d slots\n", ITEMS, SLOTS);
+	return 0;
+}
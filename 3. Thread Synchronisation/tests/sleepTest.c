@@ -0,0 +1,111 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<errno.h>
+#include<time.h>
+
+#define SLEEPER_CNT 4
+#define SLEEP_STEP_USECS 100000
+
+pthread_t threads[SLEEPER_CNT + 2];
+pthread_mutex_t mutex;
+int order[SLEEPER_CNT];
+int woken;
+volatile int done;
+volatile long spins;
+int timedlockResult;
+
+long elapsedUsecs(struct timespec *start){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+void* sleeper(void *arg){
+	int i = (int)(intptr_t)arg;
+
+	// Thread 0 sleeps the longest, so the threads wake up in reverse order
+	usleep((SLEEPER_CNT - i) * SLEEP_STEP_USECS);
+	order[woken++] = i;
+	printf("thread %lx woke up after %d ms\n", pthread_self(), (SLEEPER_CNT - i) * SLEEP_STEP_USECS / 1000);
+	return NULL;
+}
+
+void* spinner(void *arg){
+	while(!done){
+		spins++;
+	}
+	return NULL;
+}
+
+void* timedlocker(void *arg){
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += SLEEP_STEP_USECS * 1000;
+	if(deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	timedlockResult = pthread_mutex_timedlock(&mutex, &deadline);
+	printf("thread %lx timedlock returned %d\n", pthread_self(), timedlockResult);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < SLEEPER_CNT; i++) {
+		pthread_create(&threads[i], NULL, &sleeper, (void *)(intptr_t)i);
+	}
+	pthread_create(&threads[SLEEPER_CNT], NULL, &spinner, NULL);
+
+	// Sleeping must not stop the spinner from running
+	unsigned int unslept = sleep(1);
+	done = 1;
+	if(unslept != 0){
+		printf("Error, sleep(1) reported %u seconds unslept\n", unslept);
+		exit(-1);
+	}
+
+	if(woken != SLEEPER_CNT){
+		printf("Error, only %d sleepers woke up\n", woken);
+		exit(-1);
+	}
+	for (int i = 0; i < SLEEPER_CNT; i++) {
+		if(order[i] != SLEEPER_CNT - 1 - i){
+			printf("Error, sleepers woke up in the wrong order\n");
+			exit(-1);
+		}
+	}
+	if(spins == 0){
+		printf("Error, the spinner did not run while the other threads slept\n");
+		exit(-1);
+	}
+	if(elapsedUsecs(&start) < 1000000){
+		printf("Error, sleep(1) returned early\n");
+		exit(-1);
+	}
+
+	// A timed lock on a mutex that stays locked has to give up
+	pthread_mutex_init(&mutex, NULL);
+	pthread_mutex_lock(&mutex);
+	pthread_create(&threads[SLEEPER_CNT + 1], NULL, &timedlocker, NULL);
+	usleep(3 * SLEEP_STEP_USECS);
+	if(timedlockResult != ETIMEDOUT){
+		printf("Error, pthread_mutex_timedlock did not time out\n");
+		exit(-1);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	// A sleep that ran its full length leaves nothing remaining
+	struct timespec req = {0, SLEEP_STEP_USECS * 1000};
+	struct timespec rem = {1, 1};
+	if(nanosleep(&req, &rem) != 0 || rem.tv_sec != 0 || rem.tv_nsec != 0){
+		printf("Error, a full nanosleep left %ld.%09ld s remaining\n", (long) rem.tv_sec, rem.tv_nsec);
+		exit(-1);
+	}
+	return 0;
+}
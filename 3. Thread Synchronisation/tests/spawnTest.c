@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<sched.h>
+#include<errno.h>
+#include<stdint.h>
+#include "ec440.h"
+
+#define WAVE_CNT 20
+#define WAVE_SIZE 100
+
+volatile int ran;
+volatile int created;
+intptr_t sum;
+uintptr_t frames[WAVE_SIZE];
+volatile int placed;
+
+void* count(void *arg){
+	ran++;
+	sum += (intptr_t) arg;
+	return NULL;
+}
+
+void* place(void *arg){
+	int local;
+	frames[(intptr_t) arg] = (uintptr_t) &local;
+	placed++;
+	return NULL;
+}
+
+void* fiber_done(void *arg){
+	return arg;
+}
+
+int compare(const void *a, const void *b){
+	uintptr_t x = *(const uintptr_t *) a, y = *(const uintptr_t *) b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+
+	// Without the post-create yield the creator keeps the CPU
+	ec440_set_create_yield(false);
+	pthread_create(&tid, NULL, &count, NULL);
+	if(ran != 0){
+		printf("Error, the new thread ran before its creator yielded\n");
+		exit(-1);
+	}
+	while(ran != 1){
+		sched_yield();
+	}
+
+	// Many more threads than the table holds, which only works if exited slots are reused
+	pthread_t tids[WAVE_SIZE];
+	void *args[WAVE_SIZE];
+	intptr_t expected = 0;
+	for(int wave = 0; wave < WAVE_CNT; wave++){
+		for(intptr_t i = 0; i < WAVE_SIZE; i++){
+			args[i] = (void *) (i + 1);
+			expected += i + 1;
+		}
+		if(ec440_spawn_many(WAVE_SIZE, &count, args, tids) != 0){
+			printf("Error, wave %d could not be spawned\n", wave);
+			exit(-1);
+		}
+		while(ran != 1 + (wave + 1) * WAVE_SIZE){
+			sched_yield();
+		}
+	}
+	if(sum != expected){
+		printf("Error, the threads got the wrong arguments\n");
+		exit(-1);
+	}
+
+	// Fibers take over slots whose stacks came from one allocation, and give them back intact
+	for(intptr_t i = 0; i < WAVE_SIZE; i++){
+		fiber_t fiber;
+		void *value;
+		if(fiber_create(&fiber, &fiber_done, (void *) i) != 0 || fiber_resume(fiber, &value) || value != (void *) i){
+			printf("Error, fiber %ld did not run on a reused slot\n", (long) i);
+			exit(-1);
+		}
+	}
+
+	// Threads spawned together still get a stack each
+	for(intptr_t i = 0; i < WAVE_SIZE; i++){
+		args[i] = (void *) i;
+	}
+	ec440_spawn_many(WAVE_SIZE, &place, args, tids);
+	while(placed != WAVE_SIZE){
+		sched_yield();
+	}
+	qsort(frames, WAVE_SIZE, sizeof(frames[0]), &compare);
+	for(int i = 1; i < WAVE_SIZE; i++){
+		if(frames[i] - frames[i - 1] < 4096){
+			printf("Error, two threads of one spawn shared a stack\n");
+			exit(-1);
+		}
+	}
+
+	// A request the table cannot hold creates nothing
+	pthread_t too_many[1000];
+	if(ec440_spawn_many(1000, &count, NULL, too_many) != EAGAIN){
+		printf("Error, spawning more threads than fit did not fail\n");
+		exit(-1);
+	}
+	printf("%d threads ran through the table\n", ran);
+	return 0;
+}
@@ -0,0 +1,48 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include "ec440.h"
+
+#define FRAME_BYTES 512
+#define DEPTH 24
+
+volatile int finished;
+ec440_thread_stats_t stats;
+
+// Every level puts FRAME_BYTES of its own on the stack, so DEPTH levels use at least their product
+int recurse(int depth){
+	volatile char pad[FRAME_BYTES];
+	memset((char *) pad, depth, sizeof(pad));
+	if(depth > 1){
+		return recurse(depth - 1) + pad[FRAME_BYTES - 1];
+	}
+	return pad[0];
+}
+
+void* deep(void *arg){
+	recurse(DEPTH);
+	ec440_thread_stats(pthread_self(), &stats);
+	finished = 1;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+	struct timespec nap = {0, 1000000};
+
+	// Read when the library starts up with the first thread
+	setenv("EC440_STACK_CHECK", "1", 1);
+	pthread_create(&tid, NULL, &deep, NULL);
+	while(!finished){
+		nanosleep(&nap, NULL);
+	}
+
+	if(stats.stack_peak < DEPTH * FRAME_BYTES || stats.stack_peak > stats.stack_size){
+		printf("Error, %d levels of %d bytes reported a peak of %zu bytes of %zu\n", DEPTH, FRAME_BYTES, stats.stack_peak, stats.stack_size);
+		exit(-1);
+	}
+	printf("%d levels of %d bytes peaked at %zu of %zu bytes\n", DEPTH, FRAME_BYTES, stats.stack_peak, stats.stack_size);
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<signal.h>
+#include<time.h>
+#include<fcntl.h>
+#include<sys/wait.h>
+#include "ec440.h"
+
+#define YIELD_CNT 100
+#define SLEEP_USECS 20000
+#define SIGNAL_CNT 200
+#define HAMMER_CNT 2
+#define SPIN_CNT 100000
+
+volatile int finished;
+volatile int stop;
+pthread_mutex_t mutex;
+long counter;
+
+void* yielder(void *arg){
+	// Every short sleep gives the CPU up once
+	for(int i = 0; i < YIELD_CNT; i++){
+		usleep(1);
+	}
+	usleep(SLEEP_USECS);
+
+	ec440_thread_stats_t stats;
+	if(ec440_thread_stats(pthread_self(), &stats) != 0){
+		printf("Error, thread %lx has no counters\n", pthread_self());
+		exit(-1);
+	}
+	if(stats.yields < YIELD_CNT || stats.switches < YIELD_CNT){
+		printf("Error, %d sleeps counted as %lu yields and %lu switches\n", YIELD_CNT, stats.yields, stats.switches);
+		exit(-1);
+	}
+	if(stats.sleep_usecs < SLEEP_USECS){
+		printf("Error, a %d us sleep counted as %lu us\n", SLEEP_USECS, stats.sleep_usecs);
+		exit(-1);
+	}
+	finished++;
+	return NULL;
+}
+
+void* hammer(void *arg){
+	while(!stop){
+		pthread_mutex_lock(&mutex);
+		counter++;
+		pthread_mutex_unlock(&mutex);
+	}
+	finished++;
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+	struct timespec nap = {0, 1000000};
+	pthread_mutex_init(&mutex, NULL);
+
+	// The counters of a thread match what it did
+	pthread_create(&tid, NULL, &yielder, NULL);
+	while(finished < 1){
+		nanosleep(&nap, NULL);
+	}
+	printf("yields and sleep were counted\n");
+
+	// SIGUSR1 writes a header and a line per thread to stderr
+	int pipeFds[2];
+	int saved = dup(STDERR_FILENO);
+	pipe(pipeFds);
+	dup2(pipeFds[1], STDERR_FILENO);
+	raise(SIGUSR1);
+	dup2(saved, STDERR_FILENO);
+	close(pipeFds[1]);
+
+	char dump[4096];
+	ssize_t len = 0, n;
+	while((n = read(pipeFds[0], dump + len, sizeof(dump) - 1 - len)) > 0){
+		len += n;
+	}
+	dump[len] = '\0';
+	if(strncmp(dump, " tid status   ", strlen(" tid status   ")) != 0 || strstr(dump, "\n   0 running ") == NULL){
+		printf("Error, the dump was\n%s", dump);
+		exit(-1);
+	}
+	printf("SIGUSR1 dumped the counters\n");
+
+	// Signals landing while threads are inside the scheduler's critical sections must not
+	// deadlock or switch threads from the handler. A child process sends them so they arrive
+	// at any point of whichever thread is running
+	int devnull = open("/dev/null", O_WRONLY);
+	dup2(devnull, STDERR_FILENO);
+	for(int i = 0; i < HAMMER_CNT; i++){
+		pthread_create(&tid, NULL, &hammer, NULL);
+	}
+	fflush(stdout);
+	pid_t parent = getpid();
+	pid_t child = fork();
+	if(child == 0){
+		for(int i = 0; i < SIGNAL_CNT; i++){
+			kill(parent, SIGUSR1);
+			for(volatile int spin = 0; spin < SPIN_CNT; spin++);
+		}
+		_exit(0);
+	}
+	while(waitpid(child, NULL, WNOHANG) == 0){
+		nanosleep(&nap, NULL);
+	}
+	stop = 1;
+	while(finished < 1 + HAMMER_CNT){
+		nanosleep(&nap, NULL);
+	}
+	dup2(saved, STDERR_FILENO);
+	printf("survived %d dumps under contention\n", SIGNAL_CNT);
+	return 0;
+}
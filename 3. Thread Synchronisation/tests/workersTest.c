@@ -0,0 +1,206 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<time.h>
+#include<stdbool.h>
+#include<sys/syscall.h>
+#include "ec440.h"
+
+#define WORKERS "4"
+#define THREAD_CNT 8
+#define LOCK_ITERS 20000
+#define ITEMS 2000
+#define SLOTS 4
+#define ROUNDS 50
+
+// Kernel threads any green thread was seen running on
+#define KERNEL_CNT 16
+pid_t seen[KERNEL_CNT];
+int finished;
+
+// Counted with atomics, since the threads really run at the same time on different workers
+void done(){
+	__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+}
+
+void wait_for(int count){
+	struct timespec nap = {0, 1000000};
+	while(__atomic_load_n(&finished, __ATOMIC_SEQ_CST) < count){
+		nanosleep(&nap, NULL);
+	}
+	__atomic_store_n(&finished, 0, __ATOMIC_SEQ_CST);
+}
+
+void note(){
+	pid_t self = syscall(SYS_gettid);
+	for(int i = 0; i < KERNEL_CNT; i++){
+		pid_t other = __atomic_load_n(&seen[i], __ATOMIC_SEQ_CST);
+		if(other == self || (other == 0 && __atomic_compare_exchange_n(&seen[i], &other, self, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))){
+			return;
+		}
+	}
+}
+
+pthread_mutex_t mutex;
+long counter;
+
+void* locker(void *arg){
+	for(int i = 0; i < LOCK_ITERS; i++){
+		note();
+		pthread_mutex_lock(&mutex);
+		counter++;
+		pthread_mutex_unlock(&mutex);
+	}
+	done();
+	return NULL;
+}
+
+// A bounded buffer guarded by mutex, with a condition for each direction
+pthread_cond_t notEmpty, notFull;
+long buffer[SLOTS];
+int count, head;
+long consumed;
+
+void* producer(void *arg){
+	for(long i = 1; i <= ITEMS; i++){
+		note();
+		pthread_mutex_lock(&mutex);
+		while(count == SLOTS){
+			pthread_cond_wait(&notFull, &mutex);
+		}
+		buffer[(head + count++) % SLOTS] = i;
+		pthread_cond_signal(&notEmpty);
+		pthread_mutex_unlock(&mutex);
+	}
+	done();
+	return NULL;
+}
+
+void* consumer(void *arg){
+	for(int i = 0; i < ITEMS; i++){
+		note();
+		pthread_mutex_lock(&mutex);
+		while(count == 0){
+			pthread_cond_wait(&notEmpty, &mutex);
+		}
+		consumed += buffer[head];
+		head = (head + 1) % SLOTS;
+		count--;
+		pthread_cond_signal(&notFull);
+		pthread_mutex_unlock(&mutex);
+	}
+	done();
+	return NULL;
+}
+
+// Every thread checks in once per round, and nobody may start a round before all finished the last
+pthread_barrier_t barrier;
+int arrived[ROUNDS];
+volatile int barrierError;
+
+void* rounds(void *arg){
+	for(int round = 0; round < ROUNDS; round++){
+		note();
+		__atomic_add_fetch(&arrived[round], 1, __ATOMIC_SEQ_CST);
+		pthread_barrier_wait(&barrier);
+		if(__atomic_load_n(&arrived[round], __ATOMIC_SEQ_CST) != THREAD_CNT){
+			barrierError = 1;
+		}
+		pthread_barrier_wait(&barrier);
+	}
+	done();
+	return NULL;
+}
+
+chan_t *chan;
+long received;
+
+void* sender(void *arg){
+	for(long i = 1; i <= ITEMS; i++){
+		note();
+		chan_send(chan, &i);
+	}
+	done();
+	return NULL;
+}
+
+void* receiver(void *arg){
+	long item, sum = 0;
+	while(chan_recv(chan, &item) == 0){
+		note();
+		sum += item;
+	}
+	__atomic_add_fetch(&received, sum, __ATOMIC_SEQ_CST);
+	done();
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t tid;
+	long expected = (long) ITEMS * (ITEMS + 1) / 2 * (THREAD_CNT / 2);
+
+	// Read when the library starts up with the first thread
+	setenv("EC440_WORKERS", WORKERS, 1);
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&notEmpty, NULL);
+	pthread_cond_init(&notFull, NULL);
+	pthread_barrier_init(&barrier, NULL, THREAD_CNT);
+
+	for(int i = 0; i < THREAD_CNT; i++){
+		pthread_create(&tid, NULL, &locker, NULL);
+	}
+	wait_for(THREAD_CNT);
+	if(counter != (long) THREAD_CNT * LOCK_ITERS){
+		printf("Error, the mutex let %ld of %d increments through\n", counter, THREAD_CNT * LOCK_ITERS);
+		exit(-1);
+	}
+	printf("mutex held across workers\n");
+
+	for(int i = 0; i < THREAD_CNT / 2; i++){
+		pthread_create(&tid, NULL, &producer, NULL);
+		pthread_create(&tid, NULL, &consumer, NULL);
+	}
+	wait_for(THREAD_CNT);
+	if(consumed != expected){
+		printf("Error, the consumers got %ld instead of %ld\n", consumed, expected);
+		exit(-1);
+	}
+	printf("condition variables passed every item across workers\n");
+
+	for(int i = 0; i < THREAD_CNT; i++){
+		pthread_create(&tid, NULL, &rounds, NULL);
+	}
+	wait_for(THREAD_CNT);
+	if(barrierError){
+		printf("Error, a thread left the barrier before everyone arrived\n");
+		exit(-1);
+	}
+	printf("%d barrier rounds across workers\n", ROUNDS);
+
+	chan = chan_create(SLOTS, sizeof(long));
+	for(int i = 0; i < THREAD_CNT / 2; i++){
+		pthread_create(&tid, NULL, &sender, NULL);
+		pthread_create(&tid, NULL, &receiver, NULL);
+	}
+	wait_for(THREAD_CNT / 2);
+	chan_close(chan);
+	wait_for(THREAD_CNT / 2);
+	if(received != expected){
+		printf("Error, the receivers got %ld instead of %ld\n", received, expected);
+		exit(-1);
+	}
+	printf("channel passed every item across workers\n");
+
+	// Work stealing must have spread the threads over more than one kernel thread
+	int distinct = 0;
+	while(distinct < KERNEL_CNT && seen[distinct] != 0){
+		distinct++;
+	}
+	if(distinct < 2){
+		printf("Error, every thread ran on the same kernel thread\n");
+		exit(-1);
+	}
+	printf("threads ran on %d kernel threads\n", distinct);
+	return 0;
+}
@@ -1,14 +1,109 @@
 #include "ec440threads.h"
 
-/* You can support more threads. At least support this many. */
+/* You can support more threads. At least support this many. Build with
+ * -DMAX_THREADS=<n> for more */
+#ifndef MAX_THREADS
 #define MAX_THREADS 128
+#endif
 
 /* Your stack should be this many bytes in size */
 #define THREAD_STACK_SIZE 32767
 
-/* Number of microseconds between scheduling events */
+/* Byte that EC440_STACK_CHECK fills new stacks with, to find out how deep they got */
+#define STACK_FILL 0xA5
+
+/* Bottom bytes of a stack that must still hold STACK_FILL whenever the thread
+ * is switched out under EC440_STACK_CHECK */
+#define STACK_GUARD_BYTES 64
+
+/* Number of microseconds between scheduling events, unless overridden by
+ * EC440_QUANTUM_USECS or ec440_set_quantum() */
 #define SCHEDULER_INTERVAL_USECS (50 * 1000)
 
+/* Bounds on the quantum picked by the adaptive mode (EC440_ADAPTIVE_QUANTUM=1) */
+#define QUANTUM_MIN_USECS (1 * 1000)
+#define QUANTUM_MAX_USECS (400 * 1000)
+
+/* Above this many runnable threads the adaptive mode starts shrinking the quantum */
+#define ADAPTIVE_READY_THRESHOLD 2
+
+/* Number of ready queue levels. Level 0 runs first */
+#define MLFQ_LEVELS 8
+
+/* Highest level a priority 0 thread can reach. Each point of priority moves a
+ * thread's top level one step closer to 0 */
+#define MLFQ_DEFAULT_TOP 3
+
+/* After this many preemptions, the MLFQ policy moves every thread back to its top level */
+#define MLFQ_BOOST_TICKS 32
+
+/* Weight of a priority 0 thread under SP_CFS. Each point of priority adds as much again */
+#define CFS_WEIGHT 1024
+
+/* Under SP_CFS, a thread that wakes up gets at most this much head start on the
+ * least-served thread, and only preempts the running one if it is this far behind */
+#define CFS_SLEEPER_CREDIT_USECS 3000
+#define CFS_WAKEUP_GRANULARITY_USECS 1000
+
+/* Under SP_CFS, a new thread starts this far behind the least-served thread, so
+ * that creating a thread does not hand it the CPU ahead of its creator */
+#define CFS_START_DEBIT_USECS 1000
+
+/* Range accepted for sched_priority, the same as SCHED_RR */
+#define PRIORITY_MIN 0
+#define PRIORITY_MAX 99
+
+/* Resolution of the timer wheel that wakes sleeping threads */
+#define TIMER_TICK_USECS 1000
+
+/* The wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots. A slot
+ * of one level spans a whole turn of the level below */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/* sigev_value of the wheel timer, telling it apart from the quantum timers */
+#define WHEEL_TIMER_ID 1
+
+/* si_value of the SIGALRM that synchronize_rcu() sends to other workers */
+#define RCU_KICK_ID 2
+
+/* call_rcu() waits for a grace period and runs the callbacks once this many are queued. Fewer
+ * run at the next synchronize_rcu(), rcu_barrier() or exit */
+#define RCU_BATCH 64
+
+/* Most epoll events handled per io_poll() call */
+#define IO_POLL_EVENTS 64
+
+/* Samples the profiler keeps. Once the ring is full, new samples replace the oldest */
+#define PROFILE_SAMPLES 16384
+
+/* Samples per second of CPU time on each worker, unless overridden by EC440_PROFILE_HZ.
+ * Not a round number, so that sampling does not fall into step with the 1 ms timer wheel */
+#define PROFILE_DEFAULT_HZ 997
+
+/* Size the profiler assumes for the process stack that thread 0 runs on, when RLIMIT_STACK
+ * is unlimited */
+#define PROFILE_MAIN_STACK (8 * 1024 * 1024)
+
+/* Places mutexes are initialised at that EC440_LOCKSTAT keeps counters for. Mutexes from
+ * further places are not counted. Must stay below 65536, the sites are indexed with a uint16_t */
+#define LOCKSTAT_SITES 1024
+
+/* Buckets of Futex_Table, as a power of two. Waiters on different addresses that hash to
+ * the same bucket share its queue */
+#define FUTEX_BUCKET_BITS 8
+#define FUTEX_BUCKETS (1 << FUTEX_BUCKET_BITS)
+
+/* Buckets of IO_Table. Waiters on fds that are equal modulo this share a queue */
+#define IO_BUCKETS 64
+
+/* At most this many kernel workers in M:N mode (EC440_WORKERS) */
+#define MAX_WORKERS 64
+
+/* End of a ready queue */
+#define NO_THREAD ((pthread_t) -1)
+
 /* Extracted from private libc headers. These are not part of the public
  * interface for jmp_buf.
  */
@@ -23,317 +118,3297 @@
 
 // Define global variables
 thread_control_block TCB_Table[MAX_THREADS];	// Table of all threads
-pthread_t TID = 0;									// Currently running thread ID
+__thread pthread_t TID = 0;							// Thread running on the current worker
+__thread int current_worker = 0;					// Index of the current worker in Workers
+worker Workers[MAX_WORKERS];						// Kernel threads running green threads
+int idle_workers = 0;								// Workers sleeping in worker_idle()
+volatile int work_seq = 0;							// Bumped to wake idle workers up
+pthread_t Timer_Wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS] = {	// Sleeping threads by wake tick
+	[0 ... TIMER_WHEEL_LEVELS - 1] = {[0 ... TIMER_WHEEL_SLOTS - 1] = NO_THREAD}
+};
+uint64_t wheel_now = 0;								// Last tick the timer wheel processed
+int wheel_count = 0;								// Threads in the timer wheel
+uint64_t wheel_armed = 0;							// Tick the wheel timer goes off at, 0 while disarmed
+timer_t wheel_timer;								// One-shot timer that brings timer_advance() in
+int io_epoll = -1;									// epoll instance holding the fds threads wait on
+int io_waiting = 0;									// Threads blocked in io_wait()
 struct sigaction signal_handler;					// Signal handler setup for SIGALRM
+int runnable_count = 0;								// Number of threads that are TS_READY or TS_RUNNING
+int blocked_count = 0;								// Number of threads that are TS_BLOCKED
+bool create_yield = true;							// Whether pthread_create() lets the new thread run first
+pthread_t tcb_search = 1;							// Where tcb_find_empty() starts looking
+useconds_t quantum_usecs = SCHEDULER_INTERVAL_USECS;	// Base scheduling quantum
+useconds_t stretch_usecs = SCHEDULER_INTERVAL_USECS;	// Quantum stretched for CPU-bound work (adaptive mode)
+useconds_t adaptive_usecs = SCHEDULER_INTERVAL_USECS;	// Quantum currently picked by the adaptive mode
+bool adaptive_quantum = false;						// Whether the adaptive mode is on
+ready_queue Ready_Queue[MAX_WORKERS][MLFQ_LEVELS] = {	// TS_READY threads of each worker and level
+	[0 ... MAX_WORKERS - 1] = {[0 ... MLFQ_LEVELS - 1] = {NO_THREAD, NO_THREAD}}
+};
+enum sched_policy policy = SP_RR;					// Scheduling policy
+bool stack_check = false;							// Fill stacks and track their use (EC440_STACK_CHECK)
+const char *profile_path = NULL;					// File the profiler writes to at exit (EC440_PROFILE)
+long profile_hz = PROFILE_DEFAULT_HZ;				// Profiler samples per second of CPU time
+profile_sample *Profile_Ring = NULL;				// Profiler samples, PROFILE_SAMPLES of them
+uint64_t profile_head = 0;							// Samples taken so far, the next one goes at this modulo PROFILE_SAMPLES
+volatile bool profile_stopped = false;				// Set once profile_write() started reading the ring
+uintptr_t profile_restorer = 0;						// Return address of signal handlers, which marks a signal frame
+uintptr_t profile_main_low = 0;						// Lowest address thread 0's stack may grow down to
+bool lockstat_checked = false;						// Whether EC440_LOCKSTAT was looked at yet
+const char *lockstat_path = NULL;					// File the mutex contention report goes to at exit (EC440_LOCKSTAT)
+lock_site *Lock_Sites = NULL;						// Mutex contention counters by site, LOCKSTAT_SITES of them
+wait_queue Futex_Table[FUTEX_BUCKETS] = {					// Threads blocked on sync primitives, hashed by address
+	[0 ... FUTEX_BUCKETS - 1] = {NO_THREAD, NO_THREAD}
+};
+wait_queue IO_Table[IO_BUCKETS] = {					// Threads blocked in io_wait(), by fd
+	[0 ... IO_BUCKETS - 1] = {NO_THREAD, NO_THREAD}
+};
+key_info Key_Table[PTHREAD_KEYS_MAX];				// Keys of pthread_key_create()
+pthread_key_t key_limit = 0;						// Keys at or past this were never used
+pthread_t Ready_Heap[MAX_WORKERS][MAX_THREADS];		// TS_READY threads of each worker by vruntime (SP_CFS)
+int ready_heap_count[MAX_WORKERS];					// Threads in each worker's ready heap
+uint64_t cfs_min_vruntime = 0;						// Never decreasing vruntime of the least-served thread
+int mlfq_ticks = 0;									// Preemptions since the last MLFQ boost
+uint64_t rcu_gp_seq = 0;							// Grace periods started by synchronize_rcu()
+struct rcu_head *rcu_pending = NULL;				// Callbacks queued by call_rcu(), newest first
+int rcu_pending_count = 0;							// Callbacks in rcu_pending
+bool rcu_exit_flush = false;						// Whether rcu_barrier() is registered to run at exit
+int rcu_sleepers = 0;								// synchronize_rcu() calls blocked until a reader leaves its section
+uint64_t rcu_batches_taken = 0;						// Callback batches taken off rcu_pending by synchronize_rcu()
+uint64_t rcu_batches_done = 0;						// Batches whose callbacks have all run, in the order they were taken
 
-static void schedule(){
-	// Set current thread to TS_READY
-	switch(TCB_Table[TID].status){
+// Check if a thread in this state wants the CPU
+static bool is_runnable(enum thread_status status){
+	return (status == TS_READY || status == TS_RUNNING);
+}
+
+static void set_status(pthread_t tid, enum thread_status status){
+	bool wakeup = (status == TS_READY && TCB_Table[tid].status != TS_READY);
+	stats_account(tid);
+
+	runnable_count += is_runnable(status) - is_runnable(TCB_Table[tid].status);
+	blocked_count += (status == TS_BLOCKED) - (TCB_Table[tid].status == TS_BLOCKED);
+	TCB_Table[tid].status = status;
+	scheduler_timer_update();
+
+	if(wakeup){
+		ready_wake(tid);
+	}
+}
+
+static void ready_wake(pthread_t tid){
+	if(policy == SP_CFS && tid != TID){
+		cfs_place(tid);
+	}
+	ready_enqueue(tid, current_worker);
+
+	// Let a thread that outranks the running one in as soon as the current critical section ends
+	if(tid != TID && TID != NO_THREAD && resched_pending == RESCHED_NONE && wakeup_preempts(tid)){
+		resched_pending = RESCHED_WAKEUP;
+	}
+}
+
+static void stats_account(pthread_t tid){
+	thread_control_block *TCB = &TCB_Table[tid];
+	uint64_t now = monotonic_usecs();
+	uint64_t elapsed = now - TCB->status_since;
+
+	stats_charge(&TCB->stats, TCB->status, TCB->block_reason, elapsed);
+	if(TCB->status == TS_RUNNING){
+		TCB->vruntime += elapsed * CFS_WEIGHT / cfs_weight(tid);
+	}
+	TCB->status_since = now;
+}
+
+static void stats_charge(ec440_thread_stats_t *stats, enum thread_status status, enum block_reason reason, uint64_t elapsed){
+	switch(status){
 		case TS_RUNNING	:
-			TCB_Table[TID].status = TS_READY;
+			stats->run_usecs += elapsed;
 			break;
-		case TS_EXITED	:
 		case TS_READY	:
+			stats->ready_usecs += elapsed;
+			break;
 		case TS_BLOCKED	:
+			if(reason == BLOCK_SYNC){
+				stats->sync_usecs += elapsed;
+			}
+			else if(reason == BLOCK_SLEEP){
+				stats->sleep_usecs += elapsed;
+			}
+			else{
+				stats->io_usecs += elapsed;
+			}
+			break;
+		case TS_EXITED	:
 		case TS_EMPTY	:
+		case TS_FIBER	:
 			break;
 	}
+}
 
-	// Finding the next thread to schedule
-	pthread_t current_tid = TID;
-	while(1){
-		if(current_tid == MAX_THREADS - 1){
-			current_tid = 0;
+static char *stats_field(char *out, const char *text, int width, bool left){
+	int len = strlen(text);
+	if(!left){
+		for(int i = len; i < width; i++){
+			*out++ = ' ';
 		}
-		else{
-			current_tid++;
+	}
+	memcpy(out, text, len);
+	out += len;
+	if(left){
+		for(int i = len; i < width; i++){
+			*out++ = ' ';
 		}
+	}
+	*out++ = ' ';
+	return out;
+}
 
-		// If the found thread's state is TS_READY, break the loop
-		if(TCB_Table[current_tid].status == TS_READY){
-			break;
-		}
+static char *stats_number(char *out, uint64_t value, int width){
+	char digits[24];
+	int i = sizeof(digits) - 1;
+	digits[i] = '\0';
+	do{
+		digits[--i] = '0' + value % 10;
+		value /= 10;
+	}while(value != 0);
+	return stats_field(out, &digits[i], width, false);
+}
+
+static size_t stack_peak(pthread_t tid){
+	unsigned char *stack = TCB_Table[tid].stack;
+	if(!stack_check || stack == NULL){
+		return 0;
 	}
 
-	int jump = 0;
-	// If the thread has not exited, save its state
-	if(TCB_Table[TID].status != TS_EXITED){
-		jump = setjmp(TCB_Table[TID].regs);
+	// Stacks grow down, so the first byte that lost the pattern is the deepest one used
+	size_t untouched = 0;
+	while(untouched < THREAD_STACK_SIZE && stack[untouched] == STACK_FILL){
+		untouched++;
+	}
+	return THREAD_STACK_SIZE - untouched;
+}
+
+static void stack_guard_check(pthread_t tid){
+	unsigned char *stack = TCB_Table[tid].stack;
+	if(!stack_check || stack == NULL){
+		return;
 	}
 
-	// Run the next thread
-	if(!jump){
-		TID = current_tid;
-		TCB_Table[TID].status = TS_RUNNING;
-		longjmp(TCB_Table[TID].regs, 1);
+	// Only the guard bytes are checked, so this stays cheap enough to run on every switch
+	for(int i = 0; i < STACK_GUARD_BYTES; i++){
+		if(stack[i] != STACK_FILL){
+			fprintf(stderr, "ERROR: Thread %lu overflowed its %d byte stack\n", tid, THREAD_STACK_SIZE);
+			abort();
+		}
 	}
 }
 
-static void scheduler_init(){
-	// Initialise all threads as TS_EMPTY
-	for(int i = 0; i < MAX_THREADS; i++){
-		TCB_Table[i].status = TS_EMPTY;
-		TCB_Table[i].tid = i;
+static void stats_dump(int signum){
+	static const char *status_names[] = {
+		[TS_EXITED] = "exited", [TS_RUNNING] = "running", [TS_READY] = "ready", [TS_EMPTY] = "empty",
+		[TS_BLOCKED] = "blocked", [TS_FIBER] = "fiber"
+	};
+	static const char *columns[] = {
+		"switches", "preempts", "yields", "run_ms", "ready_ms", "sync_ms", "sleep_ms", "io_ms", "stack_b"
+	};
+	int saved_errno = errno;
+	char line[256];
+	char *end;
+
+	// A signal handler may not take lock() or call snprintf(), so the counters are only read,
+	// with the time in the current status added to a copy, and formatted by hand. Threads
+	// running on other workers meanwhile can leave a line a little behind
+	end = stats_field(line, "tid", 4, false);
+	end = stats_field(end, "status", 8, true);
+	for(int i = 0; i < sizeof(columns) / sizeof(columns[0]); i++){
+		end = stats_field(end, columns[i], 10, false);
 	}
+	end[-1] = '\n';
+	syscall(SYS_write, STDERR_FILENO, line, end - line);
 
-	// Setup the scheduler to SIGALRM at a specified interval
-	__useconds_t usecs = SCHEDULER_INTERVAL_USECS;
-	__useconds_t interval = SCHEDULER_INTERVAL_USECS;
-	ualarm(usecs, interval);
+	uint64_t now = monotonic_usecs();
+	for(pthread_t tid = 0; tid < MAX_THREADS; tid++){
+		thread_control_block *TCB = &TCB_Table[tid];
+		enum thread_status status = TCB->status;
+		if(status == TS_EMPTY){
+			continue;
+		}
 
-	// Round Robin
-	sigemptyset(&signal_handler.sa_mask);
-	signal_handler.sa_handler = &schedule;
-	signal_handler.sa_flags = SA_NODEFER;
-	sigaction(SIGALRM, &signal_handler, NULL);
+		ec440_thread_stats_t stats = TCB->stats;
+		uint64_t since = TCB->status_since;
+		stats_charge(&stats, status, TCB->block_reason, (now > since) ? now - since : 0);
+		end = stats_number(line, tid, 4);
+		end = stats_field(end, status_names[status], 8, true);
+		end = stats_number(end, stats.switches, 10);
+		end = stats_number(end, stats.preemptions, 10);
+		end = stats_number(end, stats.yields, 10);
+		end = stats_number(end, stats.run_usecs / 1000, 10);
+		end = stats_number(end, stats.ready_usecs / 1000, 10);
+		end = stats_number(end, stats.sync_usecs / 1000, 10);
+		end = stats_number(end, stats.sleep_usecs / 1000, 10);
+		end = stats_number(end, stats.io_usecs / 1000, 10);
+		end = stats_number(end, stack_peak(tid), 10);
+		end[-1] = '\n';
+		syscall(SYS_write, STDERR_FILENO, line, end - line);
+	}
+	errno = saved_errno;
 }
 
-int pthread_create(
-	pthread_t *thread, const pthread_attr_t *attr,
-	void *(*start_routine) (void *), void *arg)
-{
-	// Create the timer and handler for the scheduler. Create thread 0.
-	static bool is_first_call = true;
-	int main_thread = 0;
-	attr = NULL;
+static void profile_init(){
+	Profile_Ring = calloc(PROFILE_SAMPLES, sizeof(profile_sample));
+	if(Profile_Ring == NULL){
+		fprintf(stderr, "ERROR: Could not allocate the profiler's samples\n");
+		return;
+	}
+	char *env = getenv("EC440_PROFILE_HZ");
+	if(env != NULL && strtol(env, NULL, 10) > 0){
+		profile_hz = strtol(env, NULL, 10);
+	}
 
-	if (is_first_call){
-		scheduler_init();
-		is_first_call = false;
-		TCB_Table[0].status = TS_READY;
-		main_thread = setjmp(TCB_Table[0].regs);
+	// A tick must not switch threads away halfway through a sample
+	struct sigaction profile_handler;
+	memset(&profile_handler, 0, sizeof(profile_handler));
+	sigemptyset(&profile_handler.sa_mask);
+	sigaddset(&profile_handler.sa_mask, SIGALRM);
+	profile_handler.sa_sigaction = &profile_tick;
+	profile_handler.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigaction(SIGPROF, &profile_handler, NULL);
+
+	// libc points every handler's return address at the same restorer
+	struct sigaction installed;
+	sigaction(SIGPROF, NULL, &installed);
+	profile_restorer = (uintptr_t) installed.sa_restorer;
+
+	// Thread 0 has no stack of its own to check against, only the process stack and its limit
+	struct rlimit limit;
+	rlim_t size = PROFILE_MAIN_STACK;
+	if(getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY){
+		size = limit.rlim_cur;
 	}
+	profile_main_low = ((uintptr_t) __libc_stack_end > size) ? (uintptr_t) __libc_stack_end - size : 0;
 
-	// New thread
-	if (!main_thread){
-		// Find an available thread ID and save it
-        pthread_t current_tid = 1;
-        while(TCB_Table[current_tid].status != TS_EMPTY && current_tid < MAX_THREADS){
-            current_tid++;
-        }
+	atexit(&profile_write);
+}
 
-        if (current_tid == MAX_THREADS){
-            fprintf(stderr, "ERROR: Max num of threads reached\n");
-			exit(EXIT_FAILURE);
-        }
-        
-        *thread = current_tid;
+static void profile_timer_start(int worker){
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event.sigev_notify_thread_id = Workers[worker].ktid;
+	if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &Workers[worker].profile_timer) != 0){
+		return;
+	}
 
-        // Save the state
-        setjmp(TCB_Table[current_tid].regs);
-        
-		// Change PC to start_thunk
-        TCB_Table[current_tid].regs[0].__jmpbuf[JB_PC] = ptr_mangle((unsigned long int)start_thunk); 
-		
-		// R13 -> arg
-        TCB_Table[current_tid].regs[0].__jmpbuf[JB_R13] = (long) arg;  
-
-		// R12 -> start_routine
-        TCB_Table[current_tid].regs[0].__jmpbuf[JB_R12] = (unsigned long int) start_routine;
-        
-		// Create a new stack and set the pointer to the top of the stack
-        TCB_Table[current_tid].stack = malloc(THREAD_STACK_SIZE);
-		void* bottom_of_stack = TCB_Table[current_tid].stack + THREAD_STACK_SIZE;
+	struct itimerspec period;
+	period.it_value.tv_sec = 0;
+	period.it_value.tv_nsec = 1000000000L / profile_hz;
+	period.it_interval = period.it_value;
+	timer_settime(Workers[worker].profile_timer, 0, &period, NULL);
+}
 
-		// Move the address of pthread_exit() to the top of the stack
-		void* stackPointer = bottom_of_stack - sizeof(&pthread_function_return_save);
-        void (*temp)(void*) = (void*) &pthread_function_return_save;
-        stackPointer = memcpy(stackPointer, &temp, sizeof(temp));
+static void profile_tick(int signum, siginfo_t *info, void *context){
+	if(profile_stopped){
+		return;
+	}
+	ucontext_t *interrupted = context;
+	uintptr_t sp = interrupted->uc_mcontext.gregs[REG_RSP];
+	uintptr_t frame = interrupted->uc_mcontext.gregs[REG_RBP];
 
-		// Move the stack pointer(RSP) to the new stack
-        TCB_Table[current_tid].regs[0].__jmpbuf[JB_RSP] = ptr_mangle((unsigned long int)stackPointer);
+	uint64_t index = __atomic_fetch_add(&profile_head, 1, __ATOMIC_RELAXED);
+	profile_sample *sample = &Profile_Ring[index % PROFILE_SAMPLES];
+	sample->tid = (TID == NO_THREAD) ? NO_THREAD : TCB_Table[TID].fiber_current;
+	sample->fiber = (sample->tid != NO_THREAD && TCB_Table[sample->tid].status == TS_FIBER);
+	sample->pc[0] = interrupted->uc_mcontext.gregs[REG_RIP];
+	sample->depth = 1;
 
-		// Status -> TS_READY
-        TCB_Table[current_tid].status = TS_READY;
+	// Only follow frames on the stack of the running context. Right after a switch, or on an
+	// idle worker, the stack pointer is elsewhere and only the interrupted instruction is kept
+	if(sample->tid == NO_THREAD){
+		return;
+	}
+	uintptr_t low = (uintptr_t) TCB_Table[sample->tid].stack;
+	uintptr_t high = low + THREAD_STACK_SIZE;
+	if(TCB_Table[sample->tid].stack == NULL){
+		low = profile_main_low;
+		high = (uintptr_t) __libc_stack_end;
+	}
+	if(sp < low || sp >= high){
+		return;
+	}
 
-		// Set the tid
-        TCB_Table[current_tid].tid = current_tid;
+	// Interrupted on the first instruction of another signal handler, before it pushed its frame
+	if(sp + sizeof(uintptr_t) <= high && *(uintptr_t *) sp == profile_restorer){
+		frame = profile_signal_frame(sample, (uintptr_t *) sp, high);
+	}
 
-        schedule();
-		
-    }
-    else{   
-        main_thread = 0;
-    }
+	// Each frame holds the caller's frame pointer and then the return address. start_thunk leaves a
+	// NULL frame pointer in the entry function's frame, whose return address is not a real caller
+	while(sample->depth < PROFILE_DEPTH && frame >= sp && frame + 2 * sizeof(uintptr_t) <= high && frame % sizeof(uintptr_t) == 0){
+		uintptr_t *saved = (uintptr_t *) frame;
+		if(saved[0] == 0){
+			break;
+		}
+		sample->pc[sample->depth++] = saved[1];
 
-	return 0;
+		// A handler returning to the restorer was called by the kernel, on top of the context it interrupted
+		if(saved[1] == profile_restorer){
+			frame = profile_signal_frame(sample, &saved[1], high);
+			continue;
+		}
+
+		// The chain must lead outwards, or it is not a chain
+		if(saved[0] <= frame){
+			break;
+		}
+		frame = saved[0];
+	}
 }
 
-void pthread_exit(void *value_ptr){
-	// Status -> TS_EXITED
-	TCB_Table[TID].status = TS_EXITED;
+static uintptr_t profile_signal_frame(profile_sample *sample, uintptr_t *slot, uintptr_t high){
+	// The kernel puts the interrupted context right above the handler's return address
+	ucontext_t *interrupted = (ucontext_t *) (slot + 1);
+	if((uintptr_t) (interrupted + 1) > high || sample->depth >= PROFILE_DEPTH){
+		return 0;
+	}
+	if(sample->pc[sample->depth - 1] != profile_restorer){
+		sample->pc[sample->depth++] = profile_restorer;
+		if(sample->depth >= PROFILE_DEPTH){
+			return 0;
+		}
+	}
+	sample->pc[sample->depth++] = interrupted->uc_mcontext.gregs[REG_RIP];
+	return interrupted->uc_mcontext.gregs[REG_RBP];
+}
 
-	// Wait...
-	pthread_t tid = TCB_Table[TID].tid;
-	if(tid != TID){
-		TCB_Table[tid].status = TS_READY;
+static int profile_compare(const void *a, const void *b){
+	const profile_sample *x = a;
+	const profile_sample *y = b;
+	if(x->tid != y->tid){
+		return (x->tid < y->tid) ? -1 : 1;
+	}
+	if(x->depth != y->depth){
+		return x->depth - y->depth;
 	}
+	return memcmp(x->pc, y->pc, x->depth * sizeof(uintptr_t));
+}
 
-	// Check if there are any threads that are ready to exit
-	int threads_left = 0;
-	int i;
-	for(i = 0; i < MAX_THREADS; i++){
-		switch(TCB_Table[i].status){
-			case TS_READY	:
-			case TS_RUNNING	:
-			case TS_BLOCKED	:
-				threads_left = 1;
-				break;
-			case TS_EXITED	:
-			case TS_EMPTY	:
-				break;
-		}
+static void profile_write(){
+	profile_stopped = true;
+
+	FILE *out = fopen(profile_path, "w");
+	if(out == NULL){
+		fprintf(stderr, "ERROR: Could not write the profile to %s\n", profile_path);
+		return;
 	}
+	size_t count = (profile_head < PROFILE_SAMPLES) ? profile_head : PROFILE_SAMPLES;
+	qsort(Profile_Ring, count, sizeof(profile_sample), &profile_compare);
 
-	if(threads_left){
-		schedule();
+	// Identical samples are next to each other now, so each distinct one is only symbolised once
+	symbol_table table;
+	symbols_load(&table);
+	profile_stack *stacks = malloc(count * sizeof(profile_stack));
+	size_t stack_count = 0;
+	size_t same;
+	for(size_t i = 0; stacks != NULL && i < count; i = same){
+		for(same = i + 1; same < count && profile_compare(&Profile_Ring[i], &Profile_Ring[same]) == 0; same++);
+		stacks[stack_count].frames = profile_fold(&Profile_Ring[i], &table);
+		stacks[stack_count].count = same - i;
+		if(stacks[stack_count].frames != NULL){
+			stack_count++;
+		}
+	}
+	if(table.image != NULL){
+		munmap(table.image, table.size);
 	}
 
-	for(i = 0; i < MAX_THREADS; i++){
-		if(TCB_Table[i].status == TS_EXITED){
-			free(TCB_Table[i].stack);
+	// Different instructions of the same functions fold to the same text, which gets a single line
+	qsort(stacks, stack_count, sizeof(profile_stack), &profile_stack_compare);
+	for(size_t i = 0; i < stack_count; i = same){
+		size_t samples = 0;
+		for(same = i; same < stack_count && strcmp(stacks[i].frames, stacks[same].frames) == 0; same++){
+			samples += stacks[same].count;
 		}
+		fprintf(out, "%s %zu\n", stacks[i].frames, samples);
 	}
-	exit(0);
+	for(size_t i = 0; i < stack_count; i++){
+		free(stacks[i].frames);
+	}
+	free(stacks);
+	fclose(out);
 }
 
-pthread_t pthread_self(void){
-	return TID;
+static int profile_stack_compare(const void *a, const void *b){
+	return strcmp(((const profile_stack *) a)->frames, ((const profile_stack *) b)->frames);
 }
 
-//***************************************Thread Sync***************************************//
+static char *profile_fold(const profile_sample *sample, const symbol_table *table){
+	char *frames = NULL;
+	size_t len;
+	FILE *out = open_memstream(&frames, &len);
+	if(out == NULL){
+		return NULL;
+	}
 
-int pthread_mutex_init(pthread_mutex_t *restrict mutex, const pthread_mutexattr_t *restrict attr){
-	MutexControlBlock *MCB = (MutexControlBlock *) malloc(sizeof(MutexControlBlock));
+	// Outermost frame first, under the name of the context, so that a flame graph splits by green thread
+	if(sample->tid == NO_THREAD){
+		fprintf(out, "idle");
+	}
+	else{
+		fprintf(out, "%s_%lu", sample->fiber ? "fiber" : "thread", sample->tid);
+	}
+	char name[256];
+	for(int d = sample->depth - 1; d >= 0; d--){
+		// A return address points past the call, possibly into the next function
+		uintptr_t pc = (d == 0) ? sample->pc[d] : sample->pc[d] - 1;
+		if(sample->pc[d] == profile_restorer){
+			fprintf(out, ";[signal]");
+		}
+		else{
+			fprintf(out, ";%s", symbol_name(table, pc, name, sizeof(name)));
+		}
+	}
+	fclose(out);
+	return frames;
+}
+
+static void symbols_load(symbol_table *table){
+	memset(table, 0, sizeof(*table));
 
-    MCB->state = UNLOCKED;
-	MCB->wait_list = NULL;
-	MCB->wait_list_tail = NULL;
+	// threads.c is linked into the executable, so it shares its base address
+	Dl_info self;
+	if(dladdr((void *) &symbols_load, &self) == 0){
+		return;
+	}
+	int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+	if(fd < 0){
+		return;
+	}
+	struct stat info;
+	if(fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(Elf64_Ehdr)){
+		table->size = info.st_size;
+		table->image = mmap(NULL, table->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if(table->image == NULL || table->image == MAP_FAILED){
+		table->image = NULL;
+		return;
+	}
 
-	mutex->__align = (long) MCB;	// Align the struct pointer with the mutex
-   	return 0;
+	const Elf64_Ehdr *header = table->image;
+	if(memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_shoff + header->e_shnum * sizeof(Elf64_Shdr) > table->size){
+		return;
+	}
+
+	// Symbols of a position-independent executable are relative to where it was loaded
+	table->base = (header->e_type == ET_DYN) ? (uintptr_t) self.dli_fbase : 0;
+	const Elf64_Shdr *sections = table->image + header->e_shoff;
+	for(int i = 0; i < header->e_shnum; i++){
+		if(sections[i].sh_type == SHT_SYMTAB && sections[i].sh_link < header->e_shnum){
+			table->symbols = table->image + sections[i].sh_offset;
+			table->count = sections[i].sh_size / sizeof(Elf64_Sym);
+			table->names = table->image + sections[sections[i].sh_link].sh_offset;
+		}
+	}
 }
 
-int pthread_mutex_destroy(pthread_mutex_t *mutex){
-	MutexControlBlock *MCB = (MutexControlBlock *) (mutex->__align);
-	
-	if(MCB->state != LOCKED){
-		free((void *)(mutex->__align));
-		return 0;
+static const char *symbol_name(const symbol_table *table, uintptr_t pc, char *buf, size_t len){
+	for(size_t i = 0; i < table->count; i++){
+		const Elf64_Sym *symbol = &table->symbols[i];
+		uintptr_t start = table->base + symbol->st_value;
+		int type = ELF64_ST_TYPE(symbol->st_info);
+		if((type == STT_FUNC || type == STT_OBJECT) && pc >= start && pc < start + symbol->st_size){
+			return table->names + symbol->st_name;
+		}
+	}
+
+	// Shared libraries only have their exported symbols
+	Dl_info info;
+	if(dladdr((void *) pc, &info) == 0){
+		snprintf(buf, len, "0x%lx", pc);
+	}
+	else if(info.dli_sname != NULL){
+		snprintf(buf, len, "%s", info.dli_sname);
 	}
 	else{
-		return -1;
+		const char *module = strrchr(info.dli_fname, '/');
+		snprintf(buf, len, "%s+0x%lx", (module != NULL) ? module + 1 : info.dli_fname, pc - (uintptr_t) info.dli_fbase);
 	}
+	return buf;
 }
 
-int pthread_mutex_lock(pthread_mutex_t *mutex) {
- 	MutexControlBlock *MCB = (MutexControlBlock *) (mutex->__align);
-	
-	if(MCB->state == UNLOCKED){	// Thread grabs the lock
-		lock();
-		MCB->state = LOCKED;
-		unlock();
+static void lockstat_init(){
+	Lock_Sites = calloc(LOCKSTAT_SITES, sizeof(lock_site));
+	if(Lock_Sites == NULL){
+		fprintf(stderr, "ERROR: Could not allocate the mutex contention counters\n");
+		return;
+	}
+	atexit(&lockstat_write);
+}
+
+static uint16_t lockstat_site(uintptr_t site, bool initializer){
+	// Mutexes may well be set up before the first pthread_create() starts the scheduler
+	if(!lockstat_checked){
+		lockstat_checked = true;
+		lockstat_path = getenv("EC440_LOCKSTAT");
+		if(lockstat_path != NULL){
+			lockstat_init();
+		}
+	}
+	if(Lock_Sites == NULL){
 		return 0;
 	}
-	else{				// Thread is blocked since the lock is busy
-		lock();
-		TCB_Table[TID].status = TS_BLOCKED;
-		insert_tail(&MCB->wait_list, &MCB->wait_list_tail, TID);
-		
-		unlock();
-		schedule();
-		return EBUSY;
+
+	// Open addressing over every slot but 0, which stands for not counted
+	uint16_t slot = (site >> 4) * 2654435761u % (LOCKSTAT_SITES - 1) + 1;
+	for(int probe = 1; probe < LOCKSTAT_SITES; probe++){
+		if(Lock_Sites[slot].site == 0){
+			Lock_Sites[slot].site = site;
+			Lock_Sites[slot].initializer = initializer;
+		}
+		if(Lock_Sites[slot].site == site){
+			Lock_Sites[slot].mutexes++;
+			return slot;
+		}
+		slot = (slot == LOCKSTAT_SITES - 1) ? 1 : slot + 1;
 	}
+	return 0;
 }
 
-int pthread_mutex_unlock(pthread_mutex_t *mutex){
-	MutexControlBlock *MCB = (MutexControlBlock *) (mutex->__align);
-	
-	if(is_empty(MCB->wait_list)){	// No more threads waiting for the mutex
-		lock();
-		MCB->state = UNLOCKED;
-		unlock();
-		return 0;
+static void lockstat_acquired(MutexControlBlock *MCB, pthread_t tid, bool contended){
+	if(MCB->site == 0){
+		return;
 	}
-	else{										// More threads are waiting for the mutex
-		lock();
-		pthread_t next_thread;
-		get_head(&MCB->wait_list, &MCB->wait_list_tail, &next_thread);
-		MCB->state = 1;
+	lock_site *site = &Lock_Sites[MCB->site];
+	uint64_t now = monotonic_usecs();
 
-		TCB_Table[next_thread].status = TS_READY;
-			
-		unlock();
-		schedule();
-		return 0;
+	site->acquisitions++;
+	if(contended){
+		uint64_t wait = now - TCB_Table[tid].lock_wait_since;
+		site->contended++;
+		site->wait_usecs += wait;
+		if(wait > site->wait_max_usecs){
+			site->wait_max_usecs = wait;
+		}
 	}
+	MCB->locked_at = now;
 }
 
-int pthread_barrier_init(pthread_barrier_t *restrict barrier, const pthread_barrierattr_t *restrict attr, unsigned count){
-	if(count == 0){
-		return EINVAL;
+static void lockstat_released(MutexControlBlock *MCB){
+	if(MCB->site == 0){
+		return;
 	}
+	lock_site *site = &Lock_Sites[MCB->site];
+	uint64_t hold = monotonic_usecs() - MCB->locked_at;
 
-	BarrierControlBlock *BCB = (BarrierControlBlock*) malloc(sizeof(BarrierControlBlock));
+	site->hold_usecs += hold;
+	if(hold > site->hold_max_usecs){
+		site->hold_max_usecs = hold;
+		site->longest_holder = MCB->owner;
+	}
+}
 
-	BCB->init = 1;
-	BCB->flag = 0;
-	BCB->calling_thread = -1;
-	BCB->count = count;
-	BCB->left = count;
+void ec440_lockstat_report(FILE *out){
+	if(Lock_Sites == NULL){
+		return;
+	}
 
-	barrier->__align = (long) BCB;		// Align the struct pointer with the barrier
-	return 0;
+	// Sort a copy, so that the counters can go on while it is written
+	lock_site *sites = malloc(LOCKSTAT_SITES * sizeof(lock_site));
+	if(sites == NULL){
+		return;
+	}
+	lock();
+	memcpy(sites, Lock_Sites, LOCKSTAT_SITES * sizeof(lock_site));
+	unlock();
+	qsort(sites, LOCKSTAT_SITES, sizeof(lock_site), &lockstat_compare);
+
+	symbol_table table;
+	symbols_load(&table);
+	fprintf(out, "%-24s %14s %8s %10s %10s %10s %12s %10s %12s %6s\n", "site", "address", "mutexes", "acquired",
+		"contended", "wait_ms", "wait_max_us", "hold_ms", "hold_max_us", "holder");
+	char name[256];
+	for(int i = 0; i < LOCKSTAT_SITES && sites[i].site != 0; i++){
+		// A return address points past the call, possibly into the next function
+		lock_site *site = &sites[i];
+		uintptr_t address = site->initializer ? site->site : site->site - 1;
+		fprintf(out, "%-24s %#14lx %8lu %10lu %10lu %10lu %12lu %10lu %12lu %6ld\n",
+			symbol_name(&table, address, name, sizeof(name)), site->site - table.base, site->mutexes, site->acquisitions,
+			site->contended, site->wait_usecs / 1000, site->wait_max_usecs, site->hold_usecs / 1000, site->hold_max_usecs,
+			site->acquisitions ? (long) site->longest_holder : -1L);
+	}
+	if(table.image != NULL){
+		munmap(table.image, table.size);
+	}
+	free(sites);
 }
 
-int pthread_barrier_destroy(pthread_barrier_t *barrier){
-	BarrierControlBlock *BCB = (BarrierControlBlock *) (barrier->__align);
+static void lockstat_write(){
+	FILE *out = fopen(lockstat_path, "w");
+	if(out == NULL){
+		fprintf(stderr, "ERROR: Could not write the mutex contention report to %s\n", lockstat_path);
+		return;
+	}
+	ec440_lockstat_report(out);
+	fclose(out);
+}
 
-	if(BCB->init != 1){
-		BCB->init = 0;
-		BCB->calling_thread = -1;
-		BCB->count = 0;
-		BCB->left = 0;
+static int lockstat_compare(const void *a, const void *b){
+	const lock_site *x = a, *y = b;
 
-		free((void *)(barrier->__align));
-		return 0;
+	// Unused slots last
+	if((x->site == 0) != (y->site == 0)){
+		return (x->site == 0) ? 1 : -1;
 	}
-	else{
-		return -1;
+	if(x->wait_usecs != y->wait_usecs){
+		return (x->wait_usecs < y->wait_usecs) ? 1 : -1;
 	}
-	return 0;
+	if(x->contended != y->contended){
+		return (x->contended < y->contended) ? 1 : -1;
+	}
+	return (x->acquisitions < y->acquisitions) ? 1 : (x->acquisitions > y->acquisitions) ? -1 : 0;
 }
 
-int pthread_barrier_wait(pthread_barrier_t *barrier){
-	BarrierControlBlock *BCB = (BarrierControlBlock *) (barrier->__align);
-	
-	(BCB->left)--;
+static bool wakeup_preempts(pthread_t tid){
+	if(policy == SP_CFS){
+		// Bring the running thread's vruntime up to date first
+		stats_account(TID);
+		return TCB_Table[tid].vruntime + CFS_WAKEUP_GRANULARITY_USECS < TCB_Table[TID].vruntime;
+	}
+	return TCB_Table[tid].level < TCB_Table[TID].level;
+}
 
-	if(BCB->flag != 1){						// Calling thread gets blocked
-		lock();
-		TCB_Table[TID].status = TS_BLOCKED;
-		BCB->calling_thread = TID;
-		BCB->flag = 1;
+static uint64_t cfs_weight(pthread_t tid){
+	return CFS_WEIGHT * (TCB_Table[tid].priority + 1);
+}
 
-		unlock();
-		schedule();
+static void cfs_place(pthread_t tid){
+	uint64_t floor = (cfs_min_vruntime > CFS_SLEEPER_CREDIT_USECS) ? cfs_min_vruntime - CFS_SLEEPER_CREDIT_USECS : 0;
+	if(TCB_Table[tid].vruntime < floor){
+		TCB_Table[tid].vruntime = floor;
 	}
-	
-	while(BCB->left != 0){					// Other threads wait here so that they don't exit the barrier
-		schedule();
+}
+
+static bool cfs_before(pthread_t a, pthread_t b){
+	if(TCB_Table[a].vruntime != TCB_Table[b].vruntime){
+		return TCB_Table[a].vruntime < TCB_Table[b].vruntime;
 	}
-	lock();				
-	if(BCB->flag == 1){						// Unblock the calling thread
-		BCB->flag = 0;
-		TCB_Table[BCB->calling_thread].status = TS_READY;
-	}		
-	unlock();
-	schedule();							
-	if(BCB->calling_thread == TID){			// One thread returns PTHREAD_BARRIER_SERIAL_THREAD
-		BCB->left = BCB->count;
-		return PTHREAD_BARRIER_SERIAL_THREAD;
-	}	
-	else{									// Others return 0
-		return 0;
+	return TCB_Table[a].priority > TCB_Table[b].priority;
+}
+
+static void cfs_sift_up(int worker, int index){
+	pthread_t *heap = Ready_Heap[worker];
+	pthread_t tid = heap[index];
+
+	while(index > 0 && cfs_before(tid, heap[(index - 1) / 2])){
+		heap[index] = heap[(index - 1) / 2];
+		TCB_Table[heap[index]].heap_index = index;
+		index = (index - 1) / 2;
 	}
-}
\ No newline at end of file
+	heap[index] = tid;
+	TCB_Table[tid].heap_index = index;
+}
+
+static void cfs_sift_down(int worker, int index){
+	pthread_t *heap = Ready_Heap[worker];
+	pthread_t tid = heap[index];
+	int count = ready_heap_count[worker];
+
+	while(2 * index + 1 < count){
+		int child = 2 * index + 1;
+		if(child + 1 < count && cfs_before(heap[child + 1], heap[child])){
+			child++;
+		}
+		if(!cfs_before(heap[child], tid)){
+			break;
+		}
+		heap[index] = heap[child];
+		TCB_Table[heap[index]].heap_index = index;
+		index = child;
+	}
+	heap[index] = tid;
+	TCB_Table[tid].heap_index = index;
+}
+
+static int top_level(pthread_t tid){
+	int level = MLFQ_DEFAULT_TOP - TCB_Table[tid].priority;
+	return (level < 0) ? 0 : level;
+}
+
+static void ready_enqueue(pthread_t tid, int worker){
+	ready_queue *queue = &Ready_Queue[worker][TCB_Table[tid].level];
+
+	TCB_Table[tid].worker = worker;
+	if(policy == SP_CFS){
+		Ready_Heap[worker][ready_heap_count[worker]] = tid;
+		cfs_sift_up(worker, ready_heap_count[worker]++);
+	}
+	else{
+		TCB_Table[tid].ready_next = NO_THREAD;
+		if(queue->head == NO_THREAD){
+			queue->head = tid;
+		}
+		else{
+			TCB_Table[queue->tail].ready_next = tid;
+		}
+		queue->tail = tid;
+	}
+
+	// Wake an idle worker up so that it can steal the thread
+	if(idle_workers > 0 && tid != TID){
+		__atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &work_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+static pthread_t ready_dequeue(int worker){
+	if(policy == SP_CFS){
+		if(ready_heap_count[worker] == 0){
+			return NO_THREAD;
+		}
+
+		// The least-served thread is at the root
+		pthread_t tid = Ready_Heap[worker][0];
+		Ready_Heap[worker][0] = Ready_Heap[worker][--ready_heap_count[worker]];
+		if(ready_heap_count[worker] > 0){
+			cfs_sift_down(worker, 0);
+		}
+		if(TCB_Table[tid].vruntime > cfs_min_vruntime){
+			cfs_min_vruntime = TCB_Table[tid].vruntime;
+		}
+		return tid;
+	}
+
+	for(int level = 0; level < MLFQ_LEVELS; level++){
+		ready_queue *queue = &Ready_Queue[worker][level];
+		if(queue->head == NO_THREAD){
+			continue;
+		}
+
+		pthread_t tid = queue->head;
+		queue->head = TCB_Table[tid].ready_next;
+		if(queue->head == NO_THREAD){
+			queue->tail = NO_THREAD;
+		}
+		return tid;
+	}
+	return NO_THREAD;
+}
+
+static pthread_t ready_pick(){
+	pthread_t tid = ready_dequeue(current_worker);
+
+	// The local queues ran empty, so steal from the other workers
+	for(int i = 1; i < worker_count && tid == NO_THREAD; i++){
+		tid = ready_dequeue((current_worker + i) % worker_count);
+	}
+	return tid;
+}
+
+static void ready_remove(pthread_t tid){
+	ready_queue *queue = &Ready_Queue[TCB_Table[tid].worker][TCB_Table[tid].level];
+	pthread_t prev = NO_THREAD;
+	pthread_t current = queue->head;
+
+	if(policy == SP_CFS){
+		int worker = TCB_Table[tid].worker;
+		int index = TCB_Table[tid].heap_index;
+		Ready_Heap[worker][index] = Ready_Heap[worker][--ready_heap_count[worker]];
+		if(index < ready_heap_count[worker]){
+			cfs_sift_up(worker, index);
+			cfs_sift_down(worker, TCB_Table[Ready_Heap[worker][index]].heap_index);
+		}
+		return;
+	}
+
+	while(current != tid){
+		prev = current;
+		current = TCB_Table[current].ready_next;
+	}
+
+	if(prev == NO_THREAD){
+		queue->head = TCB_Table[tid].ready_next;
+	}
+	else{
+		TCB_Table[prev].ready_next = TCB_Table[tid].ready_next;
+	}
+	if(queue->tail == tid){
+		queue->tail = prev;
+	}
+}
+
+static void mlfq_account(pthread_t tid, bool preempted){
+	thread_control_block *TCB = &TCB_Table[tid];
+
+	if(TCB->status == TS_RUNNING && preempted){		// Used its whole quantum
+		if(TCB->level < MLFQ_LEVELS - 1){
+			TCB->level++;
+		}
+		if(++mlfq_ticks == MLFQ_BOOST_TICKS){
+			mlfq_ticks = 0;
+			mlfq_boost();
+		}
+	}
+	else if(TCB->status == TS_BLOCKED){				// Gave the CPU up before its quantum ran out
+		if(TCB->level > top_level(tid)){
+			TCB->level--;
+		}
+	}
+}
+
+static void mlfq_boost(){
+	// Too big for a thread's stack once MAX_THREADS is raised. The scheduler lock is held
+	static pthread_t ready[MAX_THREADS];
+	int count = 0;
+	pthread_t tid;
+
+	for(int worker = 0; worker < worker_count; worker++){
+		while((tid = ready_dequeue(worker)) != NO_THREAD){
+			ready[count++] = tid;
+		}
+	}
+	for(int i = 0; i < MAX_THREADS; i++){
+		TCB_Table[i].level = top_level(i);
+	}
+	for(int i = 0; i < count; i++){
+		ready_enqueue(ready[i], TCB_Table[ready[i]].worker);
+	}
+}
+
+static bool scheduler_timer_needed(){
+	// With no more runnable threads than workers nobody waits for a CPU, so go tickless.
+	// Threads waiting on I/O need the ticks too, so that a busy thread cannot keep epoll from being polled
+	return (runnable_count > worker_count || (io_waiting > 0 && runnable_count > 0));
+}
+
+static void scheduler_timer_update(){
+	if(!scheduler_timer_needed()){
+		return;
+	}
+
+	// Only pay for a syscall when a timer actually has to start. Stopping it waits for the next
+	// tick, so a count going back and forth across worker_count does not cost a syscall every time
+	useconds_t usecs = adaptive_quantum ? adaptive_usecs : quantum_usecs;
+	for(int i = 0; i < worker_count; i++){
+		if(Workers[i].started && Workers[i].timer_usecs == 0){
+			worker_timer_arm(i, usecs);
+		}
+	}
+}
+
+static void scheduler_timer_expire(){
+	// A tick that finds nobody waiting for a CPU is the last one this worker gets
+	if(Workers[current_worker].timer_usecs != 0 && !scheduler_timer_needed()){
+		worker_timer_arm(current_worker, 0);
+	}
+}
+
+static void worker_timer_arm(int worker, useconds_t usecs){
+	struct itimerspec timer;
+	timer.it_value.tv_sec = usecs / 1000000;
+	timer.it_value.tv_nsec = (usecs % 1000000) * 1000;
+	timer.it_interval = timer.it_value;
+
+	timer_settime(Workers[worker].timer, 0, &timer, NULL);
+	Workers[worker].timer_usecs = usecs;
+}
+
+static void quantum_config(){
+	static bool configured = false;
+	if(configured){
+		return;
+	}
+	configured = true;
+
+	char *env = getenv("EC440_QUANTUM_USECS");
+	if(env != NULL){
+		unsigned long usecs = strtoul(env, NULL, 10);
+		if(usecs > 0){
+			quantum_usecs = usecs;
+		}
+	}
+
+	env = getenv("EC440_ADAPTIVE_QUANTUM");
+	adaptive_quantum = (env != NULL && strcmp(env, "1") == 0);
+
+	stretch_usecs = quantum_usecs;
+	adaptive_usecs = quantum_usecs;
+}
+
+static void quantum_adapt(bool preempted){
+	// A thread that used its whole slice is CPU-bound, so stretch the quantum to cut switches.
+	// A thread that gave the CPU up early is interactive, so shrink it back towards the base
+	if(preempted){
+		stretch_usecs = (stretch_usecs * 2 < QUANTUM_MAX_USECS) ? stretch_usecs * 2 : QUANTUM_MAX_USECS;
+	}
+	else{
+		stretch_usecs = (stretch_usecs / 2 > quantum_usecs) ? stretch_usecs / 2 : quantum_usecs;
+	}
+
+	// With many threads ready, share a fixed latency target between them
+	useconds_t usecs = stretch_usecs;
+	if(runnable_count > ADAPTIVE_READY_THRESHOLD){
+		usecs = usecs * ADAPTIVE_READY_THRESHOLD / runnable_count;
+	}
+	if(usecs < QUANTUM_MIN_USECS){
+		usecs = QUANTUM_MIN_USECS;
+	}
+	adaptive_usecs = usecs;
+}
+
+static void scheduler_idle(){
+	sigset_t mask, old;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGALRM);
+
+	// Hold SIGALRM back so that a wheel timer going off after the last look cannot be missed
+	sigprocmask(SIG_BLOCK, &mask, &old);
+	timer_advance();
+	if(runnable_count == 0){
+		if(io_waiting > 0){
+			io_poll(-1, &old);
+		}
+		else{
+			sigsuspend(&old);
+		}
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// Microseconds on CLOCK_MONOTONIC
+static uint64_t monotonic_usecs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t timer_now(){
+	return monotonic_usecs() / TIMER_TICK_USECS;
+}
+
+static uint64_t timer_after(uint64_t usecs){
+	return (monotonic_usecs() + usecs + TIMER_TICK_USECS - 1) / TIMER_TICK_USECS;
+}
+
+static uint64_t timer_deadline(const struct timespec *abstime){
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	int64_t usecs = (abstime->tv_sec - now.tv_sec) * 1000000LL + (abstime->tv_nsec - now.tv_nsec) / 1000;
+	return (usecs > 0) ? timer_after(usecs) : timer_now();
+}
+
+static void timer_insert(pthread_t tid){
+	thread_control_block *TCB = &TCB_Table[tid];
+
+	// Anything already due goes in the next slot to be processed
+	uint64_t tick = (TCB->wake_tick > wheel_now) ? TCB->wake_tick : wheel_now + 1;
+	uint64_t delta = tick - wheel_now;
+
+	// The lowest level whose turn still covers the tick. Past the top level, wait
+	// in its farthest slot and get re-inserted when that slot cascades
+	int level = 0;
+	while(level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))){
+		level++;
+	}
+	if(delta >= (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))){
+		tick = wheel_now + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+	}
+	int slot = (tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+
+	pthread_t *head = &Timer_Wheel[level][slot];
+	TCB->timer_prev = NO_THREAD;
+	TCB->timer_next = *head;
+	if(*head != NO_THREAD){
+		TCB_Table[*head].timer_prev = tid;
+	}
+	*head = tid;
+	TCB->timer_slot = level * TIMER_WHEEL_SLOTS + slot;
+	wheel_count++;
+}
+
+static void timer_remove(pthread_t tid){
+	thread_control_block *TCB = &TCB_Table[tid];
+	pthread_t *head = &Timer_Wheel[TCB->timer_slot / TIMER_WHEEL_SLOTS][TCB->timer_slot % TIMER_WHEEL_SLOTS];
+
+	if(TCB->timer_prev == NO_THREAD){
+		*head = TCB->timer_next;
+	}
+	else{
+		TCB_Table[TCB->timer_prev].timer_next = TCB->timer_next;
+	}
+	if(TCB->timer_next != NO_THREAD){
+		TCB_Table[TCB->timer_next].timer_prev = TCB->timer_prev;
+	}
+	TCB->timer_slot = -1;
+	wheel_count--;
+}
+
+// Empty a slot, waking the threads that are due and re-inserting the others one level down
+static void timer_process_slot(int level, int slot){
+	pthread_t tid = Timer_Wheel[level][slot];
+
+	while(tid != NO_THREAD){
+		pthread_t next = TCB_Table[tid].timer_next;
+		timer_remove(tid);
+		if(TCB_Table[tid].wake_tick <= wheel_now){
+			TCB_Table[tid].timed_out = true;
+			set_status(tid, TS_READY);
+		}
+		else{
+			timer_insert(tid);
+		}
+		tid = next;
+	}
+}
+
+static void timer_advance(){
+	uint64_t now = timer_now();
+
+	while(wheel_now < now){
+		// Nothing is waiting, so skip straight to the present
+		if(wheel_count == 0){
+			wheel_now = now;
+			break;
+		}
+
+		wheel_now++;
+		for(int level = 1; level < TIMER_WHEEL_LEVELS; level++){
+			if(wheel_now & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)){
+				break;
+			}
+			timer_process_slot(level, (wheel_now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+		}
+		timer_process_slot(0, wheel_now & (TIMER_WHEEL_SLOTS - 1));
+	}
+	wheel_timer_update();
+}
+
+static void wheel_timer_update(){
+	uint64_t next = 0;
+
+	// The first non-empty slot of each level, which for levels above 0 is when it cascades
+	for(int level = 0; level < TIMER_WHEEL_LEVELS && wheel_count > 0; level++){
+		int shift = TIMER_WHEEL_BITS * level;
+		for(uint64_t i = 1; i <= TIMER_WHEEL_SLOTS; i++){
+			uint64_t block = (wheel_now >> shift) + i;
+			if(Timer_Wheel[level][block & (TIMER_WHEEL_SLOTS - 1)] != NO_THREAD){
+				if(next == 0 || (block << shift) < next){
+					next = block << shift;
+				}
+				break;
+			}
+		}
+	}
+
+	if(next == wheel_armed){
+		return;
+	}
+
+	struct itimerspec timer;
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = next * TIMER_TICK_USECS / 1000000;
+	timer.it_value.tv_nsec = (next * TIMER_TICK_USECS % 1000000) * 1000;
+	timer_settime(wheel_timer, TIMER_ABSTIME, &timer, NULL);
+	wheel_armed = next;
+}
+
+static bool io_nonblocking(int fd){
+	int flags = fcntl(fd, F_GETFL);
+	return (flags != -1 && (flags & O_NONBLOCK));
+}
+
+static void io_wait(int fd, uint32_t events){
+	struct pollfd pfd = {fd, events, 0};
+	if(poll(&pfd, 1, 0) != 0){
+		return;
+	}
+
+	// epoll takes each fd once, so a thread joining others on fd widens their registration
+	uint32_t interest = io_interest(fd);
+	struct epoll_event event;
+	event.events = interest | events | EPOLLONESHOT;
+	event.data.fd = fd;
+	TCB_Table[TID].block_reason = BLOCK_IO;
+	if(epoll_ctl(io_epoll, (interest != 0) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0){
+		// epoll cannot watch fd. Look again on the next tick
+		timer_block(timer_after(TIMER_TICK_USECS));
+		return;
+	}
+
+	TCB_Table[TID].io_fd = fd;
+	TCB_Table[TID].io_events = events;
+	wait_enqueue(io_bucket(fd), TID);
+	io_waiting++;
+	set_status(TID, TS_BLOCKED);
+	context_switch();
+}
+
+static uint32_t io_interest(int fd){
+	uint32_t interest = 0;
+	for(pthread_t tid = io_bucket(fd)->head; tid != NO_THREAD; tid = TCB_Table[tid].wait_next){
+		if(TCB_Table[tid].io_fd == fd){
+			interest |= TCB_Table[tid].io_events;
+		}
+	}
+	return interest;
+}
+
+static bool io_block(int fd, uint32_t events){
+	// Checked under lock(), so connect() flipping O_NONBLOCK for a moment is never seen here
+	lock();
+	bool blocking = !io_nonblocking(fd);
+	if(blocking){
+		io_wait(fd, events);
+	}
+	unlock();
+	return blocking;
+}
+
+static bool io_pollable(int fd){
+	struct stat st;
+	return (fstat(fd, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode) || S_ISBLK(st.st_mode)));
+}
+
+static void io_poll(int timeout, const sigset_t *mask){
+	struct epoll_event events[IO_POLL_EVENTS];
+	int count = epoll_pwait(io_epoll, events, IO_POLL_EVENTS, timeout, mask);
+
+	for(int i = 0; i < count; i++){
+		io_ready(events[i].data.fd, events[i].events);
+	}
+}
+
+static void io_ready(int fd, uint32_t ready){
+	wait_queue *bucket = io_bucket(fd);
+	uint32_t rest = 0;
+	pthread_t next;
+	for(pthread_t tid = bucket->head; tid != NO_THREAD; tid = next){
+		next = TCB_Table[tid].wait_next;
+		if(TCB_Table[tid].io_fd != fd){
+			continue;
+		}
+		// An error or hangup ends every wait, the calls then find out what happened
+		if(!(ready & (TCB_Table[tid].io_events | EPOLLERR | EPOLLHUP))){
+			rest |= TCB_Table[tid].io_events;
+			continue;
+		}
+		wait_remove(bucket, tid);
+		io_waiting--;
+		set_status(tid, TS_READY);
+	}
+
+	// EPOLLONESHOT disabled fd, so it only fires again for those still waiting if re-armed
+	if(rest != 0){
+		struct epoll_event event;
+		event.events = rest | EPOLLONESHOT;
+		event.data.fd = fd;
+		epoll_ctl(io_epoll, EPOLL_CTL_MOD, fd, &event);
+	}
+	else{
+		epoll_ctl(io_epoll, EPOLL_CTL_DEL, fd, NULL);
+	}
+}
+
+static bool timer_block(uint64_t wake_tick){
+	TCB_Table[TID].timed_out = false;
+	TCB_Table[TID].wake_tick = wake_tick;
+	timer_insert(TID);
+	wheel_timer_update();
+
+	set_status(TID, TS_BLOCKED);
+	context_switch();
+
+	// Woken up before the deadline
+	if(TCB_Table[TID].timer_slot != -1){
+		timer_remove(TID);
+		wheel_timer_update();
+	}
+	return TCB_Table[TID].timed_out;
+}
+
+static void schedule(){
+	lock();
+	context_switch();
+	unlock();
+}
+
+static void scheduler_tick(int signum, siginfo_t *info, void *context){
+	// synchronize_rcu() only needs a quiescent state from this worker, not a switch
+	if(info->si_code == SI_QUEUE && info->si_value.sival_int == RCU_KICK_ID){
+		rcu_quiescent_state();
+		return;
+	}
+
+	// The wheel timer only needs timer_advance() to run, which is not a preemption
+	if(info->si_code == SI_TIMER && info->si_value.sival_int == WHEEL_TIMER_ID){
+		if(resched_pending != RESCHED_TICK){
+			resched_pending = RESCHED_TIMER;
+		}
+	}
+	else{
+		resched_pending = RESCHED_TICK;
+	}
+
+	// An idle worker must not go to sleep on the futex after this
+	if(TID == NO_THREAD){
+		__atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+	}
+
+	// If the interrupted thread is inside one of our critical sections, switch once it leaves
+	if(preempt_count == 0){
+		schedule();
+	}
+}
+
+static void context_switch(){
+	// Whatever tick was pending is served by this switch
+	bool preempted = (resched_pending == RESCHED_TICK);
+	if(preempted){
+		scheduler_timer_expire();
+	}
+	timer_advance();
+	rcu_quiescent_state();
+
+	// A running thread that gets here without a pending reschedule asked for the switch itself
+	thread_control_block *TCB = &TCB_Table[TID];
+	if(TCB->status == TS_RUNNING && resched_pending != RESCHED_NONE){
+		TCB->stats.preemptions++;
+	}
+	else if(TCB->status == TS_RUNNING || TCB->status == TS_BLOCKED){
+		TCB->stats.yields++;
+	}
+	if(io_waiting > 0){
+		io_poll(0, NULL);
+	}
+
+	if(policy == SP_MLFQ){
+		mlfq_account(TID, preempted);
+	}
+
+	// Set current thread to TS_READY
+	switch(TCB_Table[TID].status){
+		case TS_RUNNING	:
+			set_status(TID, TS_READY);
+			break;
+		case TS_EXITED	:
+		case TS_READY	:
+		case TS_BLOCKED	:
+		case TS_EMPTY	:
+		case TS_FIBER	:
+			break;
+	}
+
+	// Finding the next thread to schedule. Every thread is blocked if there is none,
+	// so sleep instead of spinning until something wakes one up
+	pthread_t current_tid = ready_pick();
+	while(current_tid == NO_THREAD && worker_count == 1){
+		scheduler_idle();
+		current_tid = ready_pick();
+	}
+
+	int jump = 0;
+	stack_guard_check(TID);
+
+	// If the thread has not exited, save its state
+	if(TCB_Table[TID].status != TS_EXITED){
+		TCB_Table[TID].saved_errno = errno;
+		jump = setjmp(TCB_Table[TID].regs);
+	}
+
+	// Run the next thread
+	if(!jump){
+		// Another worker may resume the current thread, so wait for work on this worker's own stack
+		if(current_tid == NO_THREAD){
+			longjmp(Workers[current_worker].idle_regs, 1);
+		}
+		dispatch(current_tid, preempted);
+	}
+
+	// Switched back in, maybe on another worker
+	errno = TCB_Table[TID].saved_errno;
+}
+
+static void dispatch(pthread_t tid, bool preempted){
+	resched_pending = RESCHED_NONE;
+	TID = tid;
+	TCB_Table[TID].stats.switches++;
+	set_status(TID, TS_RUNNING);
+
+	// Give the next thread a fresh slice sized for the current workload
+	worker *self = &Workers[current_worker];
+	if(adaptive_quantum){
+		quantum_adapt(preempted);
+		if(self->timer_usecs != 0 && self->timer_usecs != adaptive_usecs){
+			worker_timer_arm(current_worker, adaptive_usecs);
+		}
+	}
+	longjmp(TCB_Table[TID].regs, 1);
+}
+
+static void scheduler_init(){
+	// Initialise all threads as TS_EMPTY
+	for(int i = 0; i < MAX_THREADS; i++){
+		TCB_Table[i].status = TS_EMPTY;
+		TCB_Table[i].tid = i;
+		TCB_Table[i].timer_slot = -1;
+		TCB_Table[i].fiber_current = i;
+	}
+	char *env = getenv("EC440_SCHED_POLICY");
+	if(env != NULL && strcmp(env, "mlfq") == 0){
+		policy = SP_MLFQ;
+	}
+	else if(env != NULL && strcmp(env, "cfs") == 0){
+		policy = SP_CFS;
+	}
+	env = getenv("EC440_STACK_CHECK");
+	stack_check = (env != NULL && strcmp(env, "1") == 0);
+	env = getenv("EC440_CREATE_YIELD");
+	if(env != NULL){
+		create_yield = (strcmp(env, "0") != 0);
+	}
+	profile_path = getenv("EC440_PROFILE");
+	if(profile_path != NULL){
+		profile_init();
+	}
+	TCB_Table[0].level = top_level(0);
+
+	// Round Robin
+	sigemptyset(&signal_handler.sa_mask);
+	signal_handler.sa_sigaction = &scheduler_tick;
+	signal_handler.sa_flags = SA_NODEFER | SA_SIGINFO;
+	sigaction(SIGALRM, &signal_handler, NULL);
+
+	// Dump the per-thread counters on SIGUSR1
+	struct sigaction stats_handler;
+	memset(&stats_handler, 0, sizeof(stats_handler));
+	sigemptyset(&stats_handler.sa_mask);
+	stats_handler.sa_handler = &stats_dump;
+	stats_handler.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &stats_handler, NULL);
+
+	// The SIGALRM timer is armed by scheduler_timer_update() once a second thread becomes runnable
+	quantum_config();
+	worker_start(0);
+
+	// Sleeping threads are woken by a one-shot timer aimed at worker 0
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGALRM;
+	event.sigev_value.sival_int = WHEEL_TIMER_ID;
+	event.sigev_notify_thread_id = Workers[0].ktid;
+	timer_create(CLOCK_MONOTONIC, &event, &wheel_timer);
+	wheel_now = timer_now();
+
+	// Threads waiting on I/O park their fds here
+	io_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+	workers_init();
+}
+
+static void workers_init(){
+	char *env = getenv("EC440_WORKERS");
+	if(env == NULL){
+		return;
+	}
+
+	long count = (strcmp(env, "auto") == 0) ? sysconf(_SC_NPROCESSORS_ONLN) : strtol(env, NULL, 10);
+	if(count <= 1){
+		return;
+	}
+	if(count > MAX_WORKERS){
+		count = MAX_WORKERS;
+	}
+
+	// The caller is inside lock(), which did not take the spinlock while there was a single worker
+	worker_count = count;
+	scheduler_spin_lock();
+
+	// Worker 0 runs on the stack of main, so its idle context gets a stack of its own
+	worker *self = &Workers[0];
+	self->idle_stack = malloc(THREAD_STACK_SIZE);
+	unsigned long int top = ((unsigned long int) self->idle_stack + THREAD_STACK_SIZE) & ~0xFUL;
+	setjmp(self->idle_regs);
+	self->idle_regs[0].__jmpbuf[JB_PC] = ptr_mangle((unsigned long int) start_thunk);
+	self->idle_regs[0].__jmpbuf[JB_R12] = (unsigned long int) worker_idle;
+	self->idle_regs[0].__jmpbuf[JB_RSP] = ptr_mangle(top - sizeof(void *));
+
+	// Our pthread_create makes green threads, so get the kernel one from libc
+	int (*kernel_pthread_create)(pthread_t *, const pthread_attr_t *, void *(*) (void *), void *) =
+		dlsym(RTLD_NEXT, "pthread_create");
+	for(int i = 1; i < worker_count; i++){
+		pthread_t thread;
+		if(kernel_pthread_create == NULL || kernel_pthread_create(&thread, NULL, &worker_main, (void *)(intptr_t) i) != 0){
+			fprintf(stderr, "ERROR: Could not start kernel worker %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void worker_start(int worker){
+	Workers[worker].ktid = gettid();
+
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGALRM;
+	event.sigev_notify_thread_id = Workers[worker].ktid;
+	timer_create(CLOCK_MONOTONIC, &event, &Workers[worker].timer);
+
+	Workers[worker].timer_usecs = 0;
+	Workers[worker].started = true;
+	scheduler_timer_update();
+
+	if(Profile_Ring != NULL){
+		profile_timer_start(worker);
+	}
+}
+
+static void *worker_main(void *arg){
+	current_worker = (int)(intptr_t) arg;
+	TID = NO_THREAD;
+
+	lock();
+	worker_start(current_worker);
+	worker_idle(NULL);
+	return NULL;
+}
+
+static void worker_idle(void *arg){
+	// context_switch() comes back here when it has nothing to run on this worker
+	setjmp(Workers[current_worker].idle_regs);
+	TID = NO_THREAD;
+
+	while(1){
+		if(resched_pending == RESCHED_TICK){
+			resched_pending = RESCHED_NONE;
+			scheduler_timer_expire();
+		}
+		timer_advance();
+		if(io_waiting > 0){
+			io_poll(0, NULL);
+		}
+		pthread_t tid = ready_pick();
+		if(tid != NO_THREAD){
+			dispatch(tid, false);
+		}
+
+		// Sleep until ready_enqueue() has something to steal. Preemption stays disabled.
+		// Nothing wakes the futex up when an fd becomes ready, so poll again every tick while threads wait on I/O
+		struct timespec io_tick = {0, TIMER_TICK_USECS * 1000};
+		int seq = __atomic_load_n(&work_seq, __ATOMIC_SEQ_CST);
+		idle_workers++;
+		scheduler_spin_unlock();
+		syscall(SYS_futex, &work_seq, FUTEX_WAIT_PRIVATE, seq, (io_waiting > 0) ? &io_tick : NULL, NULL, 0);
+		scheduler_spin_lock();
+		idle_workers--;
+	}
+}
+
+int ec440_set_quantum(useconds_t usecs){
+	if(usecs == 0){
+		return EINVAL;
+	}
+
+	lock();
+	quantum_config();
+	quantum_usecs = usecs;
+	stretch_usecs = usecs;
+	adaptive_usecs = usecs;
+	for(int i = 0; i < worker_count; i++){
+		if(Workers[i].started && Workers[i].timer_usecs != 0){
+			worker_timer_arm(i, usecs);
+		}
+	}
+	unlock();
+	return 0;
+}
+
+useconds_t ec440_get_quantum(void){
+	quantum_config();
+	return quantum_usecs;
+}
+
+int ec440_thread_stats(pthread_t thread, ec440_thread_stats_t *stats){
+	if(thread >= MAX_THREADS || TCB_Table[thread].status == TS_EMPTY){
+		return ESRCH;
+	}
+
+	lock();
+	stats_account(thread);
+	*stats = TCB_Table[thread].stats;
+	stats->stack_size = (TCB_Table[thread].stack == NULL) ? 0 : THREAD_STACK_SIZE;
+	stats->stack_peak = stack_peak(thread);
+	stats->level = TCB_Table[thread].level;
+	unlock();
+	return 0;
+}
+
+void ec440_set_create_yield(bool enabled){
+	create_yield = enabled;
+}
+
+int ec440_spawn_many(size_t n, void *(*start_routine) (void *), void **args, pthread_t *tids){
+	lock();
+	scheduler_start();
+
+	// Count the free slots first, so that a table that is too full creates nothing
+	size_t free_slots = 0;
+	for(pthread_t tid = 1; tid < MAX_THREADS; tid++){
+		free_slots += (TCB_Table[tid].status == TS_EMPTY || TCB_Table[tid].status == TS_EXITED);
+	}
+	if(free_slots < n){
+		unlock();
+		return EAGAIN;
+	}
+
+	// tcb_find_empty() carries on after the slot it returned last, so with enough free slots
+	// the calls hand out n different ones even before any of them is taken
+	for(size_t i = 0; i < n; i++){
+		tids[i] = tcb_find_empty();
+	}
+	stack_alloc_many(tids, n);
+
+	// All the threads become ready in this one critical section, and the caller switches at most once
+	for(size_t i = 0; i < n; i++){
+		thread_init(tids[i], NULL, start_routine, (args != NULL) ? args[i] : NULL);
+	}
+	if(create_yield && n > 0){
+		context_switch();
+	}
+	unlock();
+	return 0;
+}
+
+void ec440_set_adaptive_quantum(bool enabled){
+	lock();
+	quantum_config();
+	adaptive_quantum = enabled;
+	stretch_usecs = quantum_usecs;
+	adaptive_usecs = quantum_usecs;
+	unlock();
+}
+
+int pthread_create(
+	pthread_t *thread, const pthread_attr_t *attr,
+	void *(*start_routine) (void *), void *arg)
+{
+	// Create the timer and handler for the scheduler. Create thread 0.
+	int main_thread = 0;
+
+	lock();
+	if (!Workers[0].started){
+		scheduler_start();
+		main_thread = setjmp(TCB_Table[0].regs);
+	}
+
+	// New thread
+	if (!main_thread){
+		// Find an available thread ID and save it
+        pthread_t current_tid = tcb_find_empty();
+
+        if (current_tid == NO_THREAD){
+            fprintf(stderr, "ERROR: Max num of threads reached\n");
+			exit(EXIT_FAILURE);
+        }
+        
+        *thread = current_tid;
+		thread_init(current_tid, attr, start_routine, arg);
+
+		// A new thread that outranks the creator still gets in through set_status()
+		if(create_yield){
+			context_switch();
+		}
+    }
+    else{   
+        main_thread = 0;
+    }
+
+	unlock();
+	return 0;
+}
+
+static void stack_alloc_many(const pthread_t *tids, size_t n){
+	size_t missing = 0;
+	for(size_t i = 0; i < n; i++){
+		missing += (TCB_Table[tids[i]].stack == NULL);
+	}
+	// A failed allocation leaves the slots to context_init(), which tries one stack at a time
+	unsigned char *block = (missing > 1) ? malloc(missing * THREAD_STACK_SIZE) : NULL;
+	if(block == NULL){
+		return;
+	}
+
+	// The slices stay with their slots like any other stack, and are reused when the threads exit
+	for(size_t i = 0; i < n; i++){
+		if(TCB_Table[tids[i]].stack == NULL){
+			TCB_Table[tids[i]].stack = block;
+			TCB_Table[tids[i]].stack_shared = true;
+			block += THREAD_STACK_SIZE;
+		}
+	}
+}
+
+static void scheduler_start(){
+	if(!Workers[0].started){
+		scheduler_init();
+		set_status(0, TS_RUNNING);
+	}
+}
+
+static pthread_t tcb_find_empty(){
+	// Carry on from the last slot handed out, which keeps bulk creation linear. An exited
+	// thread left its stack for good when it switched away under lock(), so its slot is free too
+	for(pthread_t i = 0; i < MAX_THREADS - 1; i++){
+		pthread_t tid = 1 + (tcb_search - 1 + i) % (MAX_THREADS - 1);
+		if(TCB_Table[tid].status == TS_EMPTY || TCB_Table[tid].status == TS_EXITED){
+			tcb_search = 1 + tid % (MAX_THREADS - 1);
+			return tid;
+		}
+	}
+	return NO_THREAD;
+}
+
+static void thread_init(pthread_t tid, const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg){
+	// thread_entry calls start_routine once preemption is re-enabled
+	context_init(tid, TCB_Table[tid].regs, thread_entry, arg);
+	TCB_Table[tid].start_routine = start_routine;
+
+	// Set the tid
+	TCB_Table[tid].tid = tid;
+	TCB_Table[tid].fiber_current = tid;
+
+	// Inherit the creator's priority unless attr asks for its own
+	int inherit;
+	struct sched_param param;
+	TCB_Table[tid].priority = TCB_Table[TID].priority;
+	if(attr != NULL && pthread_attr_getinheritsched(attr, &inherit) == 0 && inherit == PTHREAD_EXPLICIT_SCHED
+		&& pthread_attr_getschedparam(attr, &param) == 0
+		&& param.sched_priority >= PRIORITY_MIN && param.sched_priority <= PRIORITY_MAX){
+		TCB_Table[tid].priority = param.sched_priority;
+	}
+	TCB_Table[tid].level = top_level(tid);
+	TCB_Table[tid].vruntime = cfs_min_vruntime + CFS_START_DEBIT_USECS;
+	memset(TCB_Table[tid].specific, 0, sizeof(TCB_Table[tid].specific));
+	TCB_Table[tid].specific_overflow = NULL;
+	memset(&TCB_Table[tid].stats, 0, sizeof(TCB_Table[tid].stats));
+	TCB_Table[tid].rcu_nesting = 0;
+
+	// Status -> TS_READY
+	set_status(tid, TS_READY);
+}
+
+static void context_init(pthread_t tid, jmp_buf regs, void (*entry)(void *), void *arg){
+	// Save the state
+	setjmp(regs);
+
+	// Change PC to start_thunk
+	regs[0].__jmpbuf[JB_PC] = ptr_mangle((unsigned long int)start_thunk);
+
+	// R13 -> arg
+	regs[0].__jmpbuf[JB_R13] = (long) arg;
+
+	// R12 -> entry
+	regs[0].__jmpbuf[JB_R12] = (unsigned long int) entry;
+
+	// Create a new stack, or take over the one a thread that exited left in the slot, and set the
+	// pointer to the top of the stack, aligned to 16 bytes as the ABI expects
+	if(TCB_Table[tid].stack == NULL){
+		TCB_Table[tid].stack = malloc(THREAD_STACK_SIZE);
+	}
+	if(stack_check){
+		memset(TCB_Table[tid].stack, STACK_FILL, THREAD_STACK_SIZE);
+	}
+	void* bottom_of_stack = (void *)(((unsigned long int) TCB_Table[tid].stack + THREAD_STACK_SIZE) & ~0xFUL);
+
+	// Move the address of pthread_exit() to the top of the stack
+	void* stackPointer = bottom_of_stack - sizeof(&pthread_function_return_save);
+	void (*temp)(void*) = (void*) &pthread_function_return_save;
+	stackPointer = memcpy(stackPointer, &temp, sizeof(temp));
+
+	// Move the stack pointer(RSP) to the new stack
+	regs[0].__jmpbuf[JB_RSP] = ptr_mangle((unsigned long int)stackPointer);
+}
+
+static void thread_entry(void *arg){
+	// New threads are switched to with preemption disabled
+	errno = 0;
+	unlock();
+	pthread_exit(TCB_Table[TID].start_routine(arg));
+}
+
+void pthread_exit(void *value_ptr){
+	// Destructors can do anything, so they run before preemption is disabled
+	specific_destroy();
+
+	if(stack_check && TCB_Table[TID].stack != NULL){
+		fprintf(stderr, "thread %lu used %zu of its %d byte stack\n", TID, stack_peak(TID), THREAD_STACK_SIZE);
+	}
+
+	lock();
+	free(TCB_Table[TID].specific_overflow);
+	TCB_Table[TID].specific_overflow = NULL;
+
+	// Status -> TS_EXITED
+	set_status(TID, TS_EXITED);
+
+	// An exited thread is quiescent, even if it never left its read-side critical section
+	if(TCB_Table[TID].rcu_nesting > 0){
+		futex_wake(&rcu_sleepers, MAX_THREADS);
+	}
+
+	// Wait...
+	pthread_t tid = TCB_Table[TID].tid;
+	if(tid != TID){
+		set_status(tid, TS_READY);
+	}
+
+	// Check if there are any threads that are ready to exit
+	if(runnable_count > 0 || blocked_count > 0){
+		context_switch();
+	}
+
+	for(int i = 0; i < MAX_THREADS; i++){
+		if(TCB_Table[i].status == TS_EXITED && !TCB_Table[i].stack_shared){
+			free(TCB_Table[i].stack);
+		}
+	}
+	exit(0);
+}
+
+pthread_t pthread_self(void){
+	return TID;
+}
+
+int pthread_setschedprio(pthread_t thread, int prio){
+	if(prio < PRIORITY_MIN || prio > PRIORITY_MAX){
+		return EINVAL;
+	}
+
+	lock();
+	if(thread >= MAX_THREADS || (thread != TID && (TCB_Table[thread].status == TS_EMPTY || TCB_Table[thread].status == TS_EXITED))){
+		unlock();
+		return ESRCH;
+	}
+
+	// A queued thread leaves whichever worker's queue or heap it is in and comes back in like
+	// a wakeup, which also lets it preempt the running thread under every policy
+	bool queued = (TCB_Table[thread].status == TS_READY);
+	if(queued){
+		ready_remove(thread);
+	}
+	TCB_Table[thread].priority = prio;
+	TCB_Table[thread].level = top_level(thread);
+	if(queued){
+		ready_wake(thread);
+	}
+
+	// Give the CPU up if a ready thread now outranks the running one
+	for(int level = 0; level < TCB_Table[TID].level; level++){
+		if(Ready_Queue[current_worker][level].head != NO_THREAD && resched_pending == RESCHED_NONE){
+			resched_pending = RESCHED_WAKEUP;
+		}
+	}
+	unlock();
+	return 0;
+}
+
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *)){
+	lock();
+	pthread_key_t new_key = 0;
+	while(new_key < PTHREAD_KEYS_MAX && Key_Table[new_key].used){
+		new_key++;
+	}
+	if(new_key == PTHREAD_KEYS_MAX){
+		unlock();
+		return EAGAIN;
+	}
+
+	// A key used before may still have values from then
+	if(new_key < key_limit){
+		for(int i = 0; i < MAX_THREADS; i++){
+			if(new_key < SPECIFIC_SLOTS){
+				TCB_Table[i].specific[new_key] = NULL;
+			}
+			else if(TCB_Table[i].specific_overflow != NULL){
+				TCB_Table[i].specific_overflow[new_key - SPECIFIC_SLOTS] = NULL;
+			}
+		}
+	}
+	else{
+		key_limit = new_key + 1;
+	}
+
+	Key_Table[new_key].used = true;
+	Key_Table[new_key].destructor = destructor;
+	unlock();
+
+	*key = new_key;
+	return 0;
+}
+
+int pthread_key_delete(pthread_key_t key){
+	if(key >= PTHREAD_KEYS_MAX || !Key_Table[key].used){
+		return EINVAL;
+	}
+
+	// Destructors are not called, as with any other pthreads
+	lock();
+	Key_Table[key].used = false;
+	unlock();
+	return 0;
+}
+
+int pthread_setspecific(pthread_key_t key, const void *value){
+	if(key >= PTHREAD_KEYS_MAX || !Key_Table[key].used){
+		return EINVAL;
+	}
+
+	const void **slot = specific_slot(key, true);
+	if(slot == NULL){
+		return ENOMEM;
+	}
+	*slot = value;
+	return 0;
+}
+
+void *pthread_getspecific(pthread_key_t key){
+	// The first keys are a single load from the TCB
+	if(key < SPECIFIC_SLOTS){
+		return (void *) TCB_Table[TID].specific[key];
+	}
+
+	const void **slot = specific_slot(key, false);
+	return (slot == NULL) ? NULL : (void *) *slot;
+}
+
+static const void **specific_slot(pthread_key_t key, bool allocate){
+	thread_control_block *TCB = &TCB_Table[TID];
+
+	if(key < SPECIFIC_SLOTS){
+		return &TCB->specific[key];
+	}
+	if(key >= PTHREAD_KEYS_MAX){
+		return NULL;
+	}
+	if(TCB->specific_overflow == NULL){
+		if(!allocate){
+			return NULL;
+		}
+
+		// malloc may take a lock of its own, so it must not be preempted by another thread's malloc
+		lock();
+		TCB->specific_overflow = calloc(PTHREAD_KEYS_MAX - SPECIFIC_SLOTS, sizeof(void *));
+		unlock();
+		if(TCB->specific_overflow == NULL){
+			return NULL;
+		}
+	}
+	return &TCB->specific_overflow[key - SPECIFIC_SLOTS];
+}
+
+static void specific_destroy(){
+	for(int round = 0; round < PTHREAD_DESTRUCTOR_ITERATIONS; round++){
+		bool called = false;
+
+		// A destructor may set values again, hence the rounds
+		for(pthread_key_t key = 0; key < key_limit; key++){
+			const void **slot = specific_slot(key, false);
+			if(slot == NULL || *slot == NULL || !Key_Table[key].used || Key_Table[key].destructor == NULL){
+				continue;
+			}
+
+			void *value = (void *) *slot;
+			*slot = NULL;
+			Key_Table[key].destructor(value);
+			called = true;
+		}
+		if(!called){
+			break;
+		}
+	}
+}
+
+int sched_yield(void){
+	// Before the first pthread_create the kernel thread is the only thread
+	if(!Workers[0].started){
+		return syscall(SYS_sched_yield);
+	}
+	schedule();
+	return 0;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem){
+	if(req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000){
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Before the first pthread_create there is nobody else to run
+	if(!Workers[0].started){
+		return syscall(SYS_nanosleep, req, rem);
+	}
+
+	uint64_t usecs = req->tv_sec * 1000000ULL + (req->tv_nsec + 999) / 1000;
+	uint64_t deadline = monotonic_usecs() + usecs;
+	lock();
+	TCB_Table[TID].block_reason = BLOCK_SLEEP;
+	bool timed_out = timer_block(timer_after(usecs));
+	unlock();
+
+	// Woken up before the deadline, like a signal would interrupt the real nanosleep
+	uint64_t now = monotonic_usecs();
+	if(!timed_out && now < deadline){
+		if(rem != NULL){
+			rem->tv_sec = (deadline - now) / 1000000;
+			rem->tv_nsec = (deadline - now) % 1000000 * 1000;
+		}
+		errno = EINTR;
+		return -1;
+	}
+	if(rem != NULL){
+		rem->tv_sec = 0;
+		rem->tv_nsec = 0;
+	}
+	return 0;
+}
+
+unsigned int sleep(unsigned int seconds){
+	struct timespec req = {seconds, 0};
+	struct timespec rem = {0, 0};
+	if(nanosleep(&req, &rem) == -1 && errno == EINTR){
+		// The seconds left unslept, rounded up like glibc does
+		return rem.tv_sec + (rem.tv_nsec > 0);
+	}
+	return 0;
+}
+
+int usleep(useconds_t usec){
+	struct timespec req = {usec / 1000000, (usec % 1000000) * 1000};
+	return nanosleep(&req, NULL);
+}
+
+ssize_t read(int fd, void *buf, size_t count){
+	if(!Workers[0].started){
+		return syscall(SYS_read, fd, buf, count);
+	}
+
+	// Try first without blocking, so that an fd with data waiting costs a single syscall
+	struct iovec iov = {buf, count};
+	ssize_t ret = preadv2(fd, &iov, 1, -1, RWF_NOWAIT);
+	while(ret == -1 && errno == EAGAIN && io_pollable(fd) && io_block(fd, EPOLLIN)){
+		ret = preadv2(fd, &iov, 1, -1, RWF_NOWAIT);
+	}
+
+	// Some fds cannot be read without waiting at all (ttys), and files on disk look ready to
+	// epoll even when the data is not cached yet. A plain read may then block the kernel thread,
+	// just like it would without green threads
+	if(ret == -1 && (errno == EOPNOTSUPP || errno == EAGAIN)){
+		io_block(fd, EPOLLIN);
+		ret = syscall(SYS_read, fd, buf, count);
+	}
+	return ret;
+}
+
+ssize_t write(int fd, const void *buf, size_t count){
+	if(!Workers[0].started){
+		return syscall(SYS_write, fd, buf, count);
+	}
+
+	// A blocking write only returns once everything is written, so keep going while the fd has room
+	size_t written = 0;
+	ssize_t ret;
+	while(1){
+		struct iovec iov = {(void *) buf + written, count - written};
+		ret = pwritev2(fd, &iov, 1, -1, RWF_NOWAIT);
+		if(ret > 0){
+			written += ret;
+		}
+		if(written == count || (ret == -1 && errno != EAGAIN) || !io_pollable(fd) || !io_block(fd, EPOLLOUT)){
+			break;
+		}
+	}
+
+	// The same fallback as read()
+	if(ret == -1 && (errno == EOPNOTSUPP || errno == EAGAIN)){
+		io_block(fd, EPOLLOUT);
+		ret = syscall(SYS_write, fd, buf + written, count - written);
+		if(ret > 0){
+			written += ret;
+		}
+	}
+	return (written > 0) ? written : ret;
+}
+
+int accept(int fd, __SOCKADDR_ARG addr, socklen_t *restrict addrlen){
+	int flags = fcntl(fd, F_GETFL);
+	if(!Workers[0].started || flags == -1 || (flags & O_NONBLOCK)){
+		return syscall(SYS_accept, fd, addr.__sockaddr__, addrlen);
+	}
+
+	// Another thread waiting on the same listener may take the connection epoll woke us for,
+	// so every attempt is made in O_NONBLOCK mode, the same way as in connect(), and a blocking
+	// accept never runs. It would hold the kernel thread and end in EINTR on the next SIGALRM.
+	// The accepted socket does not inherit the flag
+	int ret;
+	do{
+		lock();
+		flags = fcntl(fd, F_GETFL);
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+		ret = syscall(SYS_accept, fd, addr.__sockaddr__, addrlen);
+		int error = errno;
+		fcntl(fd, F_SETFL, flags);
+		errno = error;
+		unlock();
+	}while(ret == -1 && errno == EAGAIN && io_block(fd, EPOLLIN));
+	return ret;
+}
+
+int connect(int fd, __CONST_SOCKADDR_ARG addr, socklen_t addrlen){
+	int flags = fcntl(fd, F_GETFL);
+	if(!Workers[0].started || flags == -1 || (flags & O_NONBLOCK)){
+		return syscall(SYS_connect, fd, addr.__sockaddr__, addrlen);
+	}
+
+	// There is no MSG_DONTWAIT for connect, so the socket is put in O_NONBLOCK just around a
+	// connect that returns at once. Under lock() no other thread of this process runs in between,
+	// and the wrappers only look at the flag under lock(), so none of them can see it. Only
+	// another process sharing the fd could, and a socket still being connected has nothing to read
+	lock();
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	int ret = syscall(SYS_connect, fd, addr.__sockaddr__, addrlen);
+	int error = errno;
+	fcntl(fd, F_SETFL, flags);
+	errno = error;
+	unlock();
+
+	if(ret == -1 && errno == EINPROGRESS){
+		io_block(fd, EPOLLOUT);
+
+		socklen_t len = sizeof(error);
+		getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+		errno = error;
+		ret = (error == 0) ? 0 : -1;
+	}
+	return ret;
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags){
+	if(!Workers[0].started){
+		return syscall(SYS_recvfrom, fd, buf, len, flags, NULL, NULL);
+	}
+
+	// Try first, so that a socket with data waiting costs a single syscall
+	ssize_t ret = syscall(SYS_recvfrom, fd, buf, len, flags | MSG_DONTWAIT, NULL, NULL);
+	while(ret == -1 && errno == EAGAIN && !(flags & MSG_DONTWAIT) && io_block(fd, EPOLLIN)){
+		ret = syscall(SYS_recvfrom, fd, buf, len, flags | MSG_DONTWAIT, NULL, NULL);
+	}
+	return ret;
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags){
+	if(!Workers[0].started){
+		return syscall(SYS_sendto, fd, buf, len, flags, NULL, 0);
+	}
+
+	// A blocking send only returns once everything is queued, so keep going while the socket has room
+	size_t sent = 0;
+	ssize_t ret;
+	while(1){
+		ret = syscall(SYS_sendto, fd, buf + sent, len - sent, flags | MSG_DONTWAIT, NULL, 0);
+		if(ret > 0){
+			sent += ret;
+		}
+		if(sent == len || (ret == -1 && errno != EAGAIN) || (flags & MSG_DONTWAIT) || !io_block(fd, EPOLLOUT)){
+			break;
+		}
+	}
+	return (sent > 0) ? sent : ret;
+}
+
+//***************************************Fibers***************************************//
+
+int fiber_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg){
+	lock();
+	scheduler_start();
+
+	pthread_t tid = tcb_find_empty();
+	if(tid == NO_THREAD){
+		unlock();
+		return EAGAIN;
+	}
+
+	context_init(tid, TCB_Table[tid].fiber_regs, fiber_entry, arg);
+	TCB_Table[tid].tid = tid;
+	TCB_Table[tid].start_routine = start_routine;
+	TCB_Table[tid].fiber_caller = NO_THREAD;
+	TCB_Table[tid].fiber_running = false;
+	TCB_Table[tid].fiber_done = false;
+	memset(&TCB_Table[tid].stats, 0, sizeof(TCB_Table[tid].stats));
+	set_status(tid, TS_FIBER);
+	unlock();
+
+	*fiber = tid;
+	return 0;
+}
+
+fiber_t fiber_self(void){
+	return TCB_Table[TID].fiber_current;
+}
+
+int fiber_switch_to(fiber_t fiber){
+	int result = fiber_claim(fiber);
+	if(result != 0){
+		return result;
+	}
+	fiber_release(fiber_transfer(fiber));
+	return 0;
+}
+
+bool fiber_resume(fiber_t fiber, void **value){
+	int result = (fiber == TID) ? EINVAL : fiber_claim(fiber);
+	if(result != 0){
+		errno = result;
+		return false;
+	}
+
+	TCB_Table[fiber].fiber_caller = fiber_self();
+	pthread_t from = fiber_transfer(fiber);
+	if(value != NULL){
+		*value = TCB_Table[fiber].fiber_value;
+	}
+
+	bool done = TCB_Table[fiber].fiber_done;
+	fiber_release(fiber);
+	if(from != fiber){
+		fiber_release(from);
+	}
+	return !done;
+}
+
+int fiber_yield(void *value){
+	pthread_t self = fiber_self();
+	pthread_t caller = TCB_Table[self].fiber_caller;
+	if(self == TID || caller == NO_THREAD || fiber_claim(caller) != 0){
+		return EINVAL;
+	}
+
+	TCB_Table[self].fiber_value = value;
+	TCB_Table[self].fiber_caller = NO_THREAD;
+	fiber_release(fiber_transfer(caller));
+	return 0;
+}
+
+static void fiber_entry(void *arg){
+	pthread_t self = fiber_self();
+	fiber_arrived(self);
+	void *value = TCB_Table[self].start_routine(arg);
+
+	// Hand the result to whoever resumed the fiber, or to the thread it runs in
+	pthread_t caller = TCB_Table[self].fiber_caller;
+	TCB_Table[self].fiber_value = value;
+	TCB_Table[self].fiber_done = true;
+	if(caller == NO_THREAD || fiber_claim(caller) != 0){
+		caller = TID;
+		fiber_claim(caller);
+	}
+	fiber_transfer(caller);
+	__builtin_unreachable();
+}
+
+static pthread_t fiber_transfer(pthread_t target){
+	// target was claimed by the caller. Neither context is ever seen by the scheduler, so a
+	// tick in between just preempts the thread, whatever context it is running
+	pthread_t self = fiber_self();
+	TCB_Table[TID].fiber_current = target;
+	TCB_Table[target].fiber_from = self;
+
+	if(!setjmp(TCB_Table[self].fiber_regs)){
+		longjmp(TCB_Table[target].fiber_regs, 1);
+	}
+	return fiber_arrived(self);
+}
+
+static pthread_t fiber_arrived(pthread_t self){
+	// Only now that nothing runs on its stack any more may another thread claim the context
+	// that switched here
+	pthread_t from = TCB_Table[self].fiber_from;
+	__atomic_store_n(&TCB_Table[from].fiber_running, false, __ATOMIC_RELEASE);
+	return from;
+}
+
+static int fiber_claim(fiber_t fiber){
+	lock();
+	int result = 0;
+	if(fiber != TID && fiber < MAX_THREADS && TCB_Table[fiber].status == TS_FIBER
+		&& !TCB_Table[fiber].fiber_done && TCB_Table[fiber].fiber_running){
+		result = EBUSY;
+	}else if(!fiber_can_run(fiber)){
+		result = EINVAL;
+	}else{
+		TCB_Table[fiber].fiber_running = true;
+	}
+	unlock();
+	return result;
+}
+
+static bool fiber_can_run(fiber_t fiber){
+	// A thread can only get back to its own context, never to another thread's
+	if(fiber == TID){
+		return fiber_self() != TID;
+	}
+	return (fiber < MAX_THREADS && TCB_Table[fiber].status == TS_FIBER
+		&& !TCB_Table[fiber].fiber_running && !TCB_Table[fiber].fiber_done);
+}
+
+static void fiber_release(pthread_t fiber){
+	if(fiber == NO_THREAD || fiber >= MAX_THREADS || TCB_Table[fiber].status != TS_FIBER || !TCB_Table[fiber].fiber_done){
+		return;
+	}
+
+	lock();
+	// A slice of a bulk allocation stays in the slot for the next thread or fiber
+	if(!TCB_Table[fiber].stack_shared){
+		free(TCB_Table[fiber].stack);
+		TCB_Table[fiber].stack = NULL;
+	}
+	set_status(fiber, TS_EMPTY);
+	unlock();
+}
+
+//***************************************Thread Sync***************************************//
+
+static void wait_enqueue(wait_queue *queue, pthread_t tid){
+	TCB_Table[tid].wait_next = NO_THREAD;
+	if(queue->head == NO_THREAD){
+		queue->head = tid;
+	}
+	else{
+		TCB_Table[queue->tail].wait_next = tid;
+	}
+	queue->tail = tid;
+}
+
+static bool wait_remove(wait_queue *queue, pthread_t tid){
+	pthread_t prev = NO_THREAD;
+	for(pthread_t node = queue->head; node != NO_THREAD; prev = node, node = TCB_Table[node].wait_next){
+		if(node == tid){
+			if(prev == NO_THREAD){
+				queue->head = TCB_Table[node].wait_next;
+			}
+			else{
+				TCB_Table[prev].wait_next = TCB_Table[node].wait_next;
+			}
+			if(queue->tail == node){
+				queue->tail = prev;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+static wait_queue *futex_bucket(const void *addr){
+	// Multiplicative hashing, keeping the well-mixed top bits
+	uint32_t hash = (uint32_t)(((uintptr_t) addr >> 3) * 2654435761u);
+	return &Futex_Table[hash >> (32 - FUTEX_BUCKET_BITS)];
+}
+
+static wait_queue *io_bucket(int fd){
+	return &IO_Table[(unsigned) fd % IO_BUCKETS];
+}
+
+static void futex_enqueue(const void *addr, pthread_t tid){
+	TCB_Table[tid].wait_addr = addr;
+	wait_enqueue(futex_bucket(addr), tid);
+}
+
+static pthread_t futex_dequeue(const void *addr){
+	wait_queue *bucket = futex_bucket(addr);
+	for(pthread_t tid = bucket->head; tid != NO_THREAD; tid = TCB_Table[tid].wait_next){
+		if(TCB_Table[tid].wait_addr == addr){
+			wait_remove(bucket, tid);
+			TCB_Table[tid].wait_addr = NULL;
+			return tid;
+		}
+	}
+	return NO_THREAD;
+}
+
+static bool futex_remove(const void *addr, pthread_t tid){
+	if(TCB_Table[tid].wait_addr != addr){
+		return false;
+	}
+	wait_remove(futex_bucket(addr), tid);
+	TCB_Table[tid].wait_addr = NULL;
+	return true;
+}
+
+static bool futex_waiting(const void *addr){
+	for(pthread_t tid = futex_bucket(addr)->head; tid != NO_THREAD; tid = TCB_Table[tid].wait_next){
+		if(TCB_Table[tid].wait_addr == addr){
+			return true;
+		}
+	}
+	return false;
+}
+
+static void futex_wait(const void *addr){
+	TCB_Table[TID].block_reason = BLOCK_SYNC;
+	set_status(TID, TS_BLOCKED);
+	futex_enqueue(addr, TID);
+	context_switch();
+}
+
+static int futex_wake(const void *addr, int n){
+	int woken = 0;
+	pthread_t tid;
+	while(woken < n && (tid = futex_dequeue(addr)) != NO_THREAD){
+		set_status(tid, TS_READY);
+		woken++;
+	}
+	return woken;
+}
+
+int ec440_wait(int *addr, int expected){
+	// ec440_wake() also runs under lock(), so it cannot slip in between the check and the block
+	lock();
+	if(__atomic_load_n(addr, __ATOMIC_RELAXED) != expected){
+		unlock();
+		return EAGAIN;
+	}
+	futex_wait(addr);
+	unlock();
+	return 0;
+}
+
+int ec440_wake(int *addr, int n){
+	lock();
+	int woken = futex_wake(addr, n);
+	unlock();
+	return woken;
+}
+
+static MutexControlBlock *mutex_block(pthread_mutex_t *mutex){
+	MutexControlBlock *MCB = (MutexControlBlock *) mutex;
+
+	// A zeroed mutex is already UNLOCKED, but 0 is a valid owner. It has no pthread_mutex_init()
+	// call to be known by, so its contention is counted under its own address
+	if(!MCB->initialised){
+		mutex_setup(MCB, (uintptr_t) mutex, true);
+	}
+	return MCB;
+}
+
+static void mutex_setup(MutexControlBlock *MCB, uintptr_t site, bool initializer){
+	MCB->state = UNLOCKED;
+	MCB->owner = NO_THREAD;
+	MCB->site = lockstat_site(site, initializer);
+	MCB->initialised = true;
+}
+
+int pthread_mutex_init(pthread_mutex_t *restrict mutex, const pthread_mutexattr_t *restrict attr){
+	// Only the table of sites needs lock(), nobody else may use the mutex yet
+	lock();
+	mutex_setup((MutexControlBlock *) mutex, (uintptr_t) __builtin_return_address(0), false);
+	unlock();
+	return 0;
+}
+
+static void mutex_wait(MutexControlBlock *MCB, pthread_t tid){
+	if(MCB->site != 0){
+		TCB_Table[tid].lock_wait_since = monotonic_usecs();
+	}
+	futex_enqueue(MCB, tid);
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex){
+	lock();
+	MutexControlBlock *MCB = mutex_block(mutex);
+	
+	if(MCB->state != LOCKED){
+		MCB->initialised = false;
+		unlock();
+		return 0;
+	}
+	else{
+		unlock();
+		return -1;
+	}
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+	lock();
+	mutex_acquire(mutex_block(mutex));
+	unlock();
+	return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex){
+	lock();
+	mutex_release(mutex_block(mutex));
+	unlock();
+	return 0;
+}
+
+static void mutex_acquire(MutexControlBlock *MCB){
+	if(MCB->state == UNLOCKED){	// Thread grabs the lock
+		MCB->state = LOCKED;
+		MCB->owner = TID;
+		lockstat_acquired(MCB, TID, false);
+		return;
+	}
+
+	// Thread is blocked since the lock is busy. It is only woken up by mutex_release(),
+	// which makes it the owner first
+	TCB_Table[TID].block_reason = BLOCK_SYNC;
+	set_status(TID, TS_BLOCKED);
+	mutex_wait(MCB, TID);
+	context_switch();
+}
+
+static void mutex_release(MutexControlBlock *MCB){
+	lockstat_released(MCB);
+	pthread_t next_thread = futex_dequeue(MCB);
+	if(next_thread == NO_THREAD){	// No more threads waiting for the mutex
+		MCB->state = UNLOCKED;
+		MCB->owner = NO_THREAD;
+		return;
+	}
+
+	// Hand the mutex to the first waiter, which stays LOCKED. The caller keeps the CPU,
+	// unless the waiter outranks it
+	MCB->owner = next_thread;
+	lockstat_acquired(MCB, next_thread, true);
+	set_status(next_thread, TS_READY);
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t *restrict mutex, const struct timespec *restrict abstime){
+	if(abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000){
+		return EINVAL;
+	}
+	uint64_t deadline = timer_deadline(abstime);
+
+	lock();
+	MutexControlBlock *MCB = mutex_block(mutex);
+	bool waited = false;
+	while(MCB->state == LOCKED){
+		if(timer_now() >= deadline){
+			unlock();
+			return ETIMEDOUT;
+		}
+
+		// Wait in both the mutex's queue and the timer wheel, whichever comes first
+		TCB_Table[TID].block_reason = BLOCK_SYNC;
+		mutex_wait(MCB, TID);
+		waited = true;
+		timer_block(deadline);
+		if(MCB->owner == TID){
+			unlock();
+			return 0;
+		}
+		futex_remove(MCB, TID);
+	}
+	MCB->state = LOCKED;
+	MCB->owner = TID;
+	lockstat_acquired(MCB, TID, waited);
+	unlock();
+	return 0;
+}
+
+static void cond_wake(pthread_t tid){
+	MutexControlBlock *MCB = mutex_block(TCB_Table[tid].cond_mutex);
+	if(MCB->state == UNLOCKED){
+		MCB->state = LOCKED;
+		MCB->owner = tid;
+		lockstat_acquired(MCB, tid, false);
+		set_status(tid, TS_READY);
+	}
+	else{
+		mutex_wait(MCB, tid);
+	}
+}
+
+int pthread_cond_init(pthread_cond_t *restrict cond, const pthread_condattr_t *restrict attr){
+	// A condition variable is only the address its waiters wait on in Futex_Table
+	return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond){
+	lock();
+	if(futex_waiting(cond)){
+		unlock();
+		return EBUSY;
+	}
+	unlock();
+	return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *restrict cond, pthread_mutex_t *restrict mutex){
+	lock();
+	MutexControlBlock *MCB = mutex_block(mutex);
+
+	// Nothing can signal between the unlock and the wait, since both happen under lock()
+	TCB_Table[TID].cond_mutex = mutex;
+	mutex_release(MCB);
+
+	// Only woken up once cond_wake() or a mutex handoff made this thread the owner
+	futex_wait(cond);
+	unlock();
+	return 0;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *restrict cond, pthread_mutex_t *restrict mutex,
+	const struct timespec *restrict abstime){
+	if(abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000){
+		return EINVAL;
+	}
+	uint64_t deadline = timer_deadline(abstime);
+
+	lock();
+	MutexControlBlock *MCB = mutex_block(mutex);
+
+	// Wait in both the condition's queue and the timer wheel, whichever comes first
+	TCB_Table[TID].cond_mutex = mutex;
+	TCB_Table[TID].block_reason = BLOCK_SYNC;
+	futex_enqueue(cond, TID);
+	mutex_release(MCB);
+	timer_block(deadline);
+
+	// Still on the condition means the timer woke the thread, which then takes the mutex back
+	int result = 0;
+	if(futex_remove(cond, TID)){
+		result = ETIMEDOUT;
+		mutex_acquire(MCB);
+	}
+
+	// A signal may have moved the thread to the mutex's queue, where the timer can also wake it
+	while(MCB->owner != TID){
+		set_status(TID, TS_BLOCKED);
+		context_switch();
+	}
+	unlock();
+	return result;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond){
+	lock();
+	pthread_t tid = futex_dequeue(cond);
+	if(tid != NO_THREAD){
+		cond_wake(tid);
+	}
+	unlock();
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond){
+	lock();
+	pthread_t tid;
+	while((tid = futex_dequeue(cond)) != NO_THREAD){
+		cond_wake(tid);
+	}
+	unlock();
+	return 0;
+}
+
+static RwlockControlBlock *rwlock_block(pthread_rwlock_t *rwlock){
+	RwlockControlBlock *RCB = (RwlockControlBlock *) rwlock;
+
+	// A zeroed lock has no readers and no waiting writers, but 0 is a valid writer
+	if(!RCB->initialised){
+		RCB->writer = NO_THREAD;
+		RCB->initialised = true;
+	}
+	return RCB;
+}
+
+int pthread_rwlock_init(pthread_rwlock_t *restrict rwlock, const pthread_rwlockattr_t *restrict attr){
+	RwlockControlBlock *RCB = (RwlockControlBlock *) rwlock;
+
+	RCB->initialised = false;
+	RCB->readers = 0;
+	RCB->writers_waiting = 0;
+	rwlock_block(rwlock);	// Nobody else may use the lock yet, so no need for lock()
+	return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock){
+	lock();
+	RwlockControlBlock *RCB = rwlock_block(rwlock);
+	if(RCB->readers != 0 || RCB->writer != NO_THREAD || RCB->writers_waiting != 0 || futex_waiting(&RCB->readers)){
+		unlock();
+		return EBUSY;
+	}
+	RCB->initialised = false;
+	unlock();
+	return 0;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock){
+	lock();
+	RwlockControlBlock *RCB = rwlock_block(rwlock);
+	if(RCB->writer == TID){
+		unlock();
+		return EDEADLK;
+	}
+
+	// A waiting writer keeps new readers out, or a steady stream of them would starve it
+	if(RCB->writer == NO_THREAD && RCB->writers_waiting == 0){
+		RCB->readers++;
+		unlock();
+		return 0;
+	}
+
+	// Only woken up by pthread_rwlock_unlock(), which counts this thread as a reader first
+	futex_wait(&RCB->readers);
+	unlock();
+	return 0;
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock){
+	lock();
+	RwlockControlBlock *RCB = rwlock_block(rwlock);
+	if(RCB->writer != NO_THREAD || RCB->writers_waiting != 0){
+		unlock();
+		return EBUSY;
+	}
+	RCB->readers++;
+	unlock();
+	return 0;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock){
+	lock();
+	RwlockControlBlock *RCB = rwlock_block(rwlock);
+	if(RCB->writer == TID){
+		unlock();
+		return EDEADLK;
+	}
+	if(RCB->writer == NO_THREAD && RCB->readers == 0){
+		RCB->writer = TID;
+		unlock();
+		return 0;
+	}
+
+	// Only woken up by pthread_rwlock_unlock(), which makes this thread the writer first
+	RCB->writers_waiting++;
+	futex_wait(&RCB->writer);
+	unlock();
+	return 0;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock){
+	lock();
+	RwlockControlBlock *RCB = rwlock_block(rwlock);
+	if(RCB->writer != NO_THREAD || RCB->readers != 0){
+		unlock();
+		return EBUSY;
+	}
+	RCB->writer = TID;
+	unlock();
+	return 0;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock){
+	lock();
+	RwlockControlBlock *RCB = rwlock_block(rwlock);
+	if(RCB->writer == TID){
+		RCB->writer = NO_THREAD;
+	}
+	else if(RCB->readers > 0){
+		RCB->readers--;
+	}
+	else{
+		unlock();
+		return EPERM;
+	}
+
+	if(RCB->readers == 0){
+		// Writers go first. Readers only get the lock once no writer waits, and then all of them at once
+		pthread_t tid = futex_dequeue(&RCB->writer);
+		if(tid != NO_THREAD){
+			RCB->writers_waiting--;
+			RCB->writer = tid;
+			set_status(tid, TS_READY);
+		}
+		else{
+			while((tid = futex_dequeue(&RCB->readers)) != NO_THREAD){
+				RCB->readers++;
+				set_status(tid, TS_READY);
+			}
+		}
+	}
+	unlock();
+	return 0;
+}
+
+int sem_init(sem_t *sem, int pshared, unsigned value){
+	if(pshared != 0){
+		errno = ENOSYS;
+		return -1;
+	}
+	if(value > SEM_VALUE_MAX){
+		errno = EINVAL;
+		return -1;
+	}
+
+	SemaphoreControlBlock *SCB = (SemaphoreControlBlock *) sem;
+	SCB->value = value;
+	return 0;
+}
+
+int sem_destroy(sem_t *sem){
+	SemaphoreControlBlock *SCB = (SemaphoreControlBlock *) sem;
+
+	lock();
+	if(futex_waiting(SCB)){
+		unlock();
+		errno = EBUSY;
+		return -1;
+	}
+	unlock();
+	return 0;
+}
+
+int sem_wait(sem_t *sem){
+	SemaphoreControlBlock *SCB = (SemaphoreControlBlock *) sem;
+
+	lock();
+	if(SCB->value > 0){
+		SCB->value--;
+		unlock();
+		return 0;
+	}
+
+	// Only woken up by sem_post(), which hands its unit straight to this thread
+	futex_wait(SCB);
+	unlock();
+	return 0;
+}
+
+int sem_trywait(sem_t *sem){
+	SemaphoreControlBlock *SCB = (SemaphoreControlBlock *) sem;
+
+	lock();
+	if(SCB->value == 0){
+		unlock();
+		errno = EAGAIN;
+		return -1;
+	}
+	SCB->value--;
+	unlock();
+	return 0;
+}
+
+int sem_timedwait(sem_t *restrict sem, const struct timespec *restrict abstime){
+	SemaphoreControlBlock *SCB = (SemaphoreControlBlock *) sem;
+
+	// abstime is only looked at when the thread has to wait
+	lock();
+	if(SCB->value > 0){
+		SCB->value--;
+		unlock();
+		return 0;
+	}
+	unlock();
+
+	if(abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000){
+		errno = EINVAL;
+		return -1;
+	}
+	uint64_t deadline = timer_deadline(abstime);
+
+	lock();
+	if(SCB->value > 0){
+		SCB->value--;
+		unlock();
+		return 0;
+	}
+	if(timer_now() >= deadline){
+		unlock();
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	// Wait in both the semaphore's queue and the timer wheel, whichever comes first.
+	// Still being queued afterwards means nothing was handed over
+	TCB_Table[TID].block_reason = BLOCK_SYNC;
+	futex_enqueue(SCB, TID);
+	timer_block(deadline);
+	if(futex_remove(SCB, TID)){
+		unlock();
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	unlock();
+	return 0;
+}
+
+int sem_post(sem_t *sem){
+	SemaphoreControlBlock *SCB = (SemaphoreControlBlock *) sem;
+
+	lock();
+	pthread_t tid = futex_dequeue(SCB);
+	if(tid != NO_THREAD){
+		// The value stays 0, so no thread that comes later can take the unit first
+		set_status(tid, TS_READY);
+	}
+	else if(SCB->value == SEM_VALUE_MAX){
+		unlock();
+		errno = EOVERFLOW;
+		return -1;
+	}
+	else{
+		SCB->value++;
+	}
+	unlock();
+	return 0;
+}
+
+int sem_getvalue(sem_t *restrict sem, int *restrict sval){
+	SemaphoreControlBlock *SCB = (SemaphoreControlBlock *) sem;
+
+	lock();
+	*sval = SCB->value;
+	unlock();
+	return 0;
+}
+
+int pthread_barrier_init(pthread_barrier_t *restrict barrier, const pthread_barrierattr_t *restrict attr, unsigned count){
+	if(count == 0){
+		return EINVAL;
+	}
+
+	BarrierControlBlock *BCB = (BarrierControlBlock *) barrier;
+	BCB->count = count;
+	BCB->left = count;
+	BCB->generation = 0;
+	return 0;
+}
+
+int pthread_barrier_destroy(pthread_barrier_t *barrier){
+	BarrierControlBlock *BCB = (BarrierControlBlock *) barrier;
+
+	lock();
+	if(futex_waiting(&BCB->generation)){
+		unlock();
+		return EBUSY;
+	}
+	BCB->count = 0;
+	unlock();
+	return 0;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier){
+	BarrierControlBlock *BCB = (BarrierControlBlock *) barrier;
+
+	lock();
+	if(--BCB->left == 0){		// Last thread to arrive opens the barrier for everyone
+		BCB->left = BCB->count;
+		BCB->generation++;
+		futex_wake(&BCB->generation, INT_MAX);
+		unlock();
+		return PTHREAD_BARRIER_SERIAL_THREAD;
+	}
+
+	// The others block until their generation is over. Threads that arrive for the next one
+	// only wait once it has started, so a barrier used back to back cannot let them through early
+	unsigned generation = BCB->generation;
+	while(BCB->generation == generation){
+		futex_wait(&BCB->generation);
+	}
+	unlock();
+	return 0;
+}
+
+//***************************************RCU***************************************//
+
+void rcu_read_lock(void){
+	TCB_Table[TID].rcu_nesting++;
+
+	// Reads of the protected data must not move above this. Only the compiler could move them:
+	// synchronize_rcu() waits for this thread to pass a switch or a signal, both full barriers
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcu_read_unlock(void){
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+	// Leaving the outermost section is a quiescent state too, or a thread that is only ever
+	// switched out inside one would hold every grace period up. Only when an updater sleeps
+	// waiting for it does the reader pay for taking lock() to wake it up
+	if(--TCB_Table[TID].rcu_nesting == 0){
+		rcu_quiescent_state();
+		if(__atomic_load_n(&rcu_sleepers, __ATOMIC_SEQ_CST) > 0){
+			lock();
+			futex_wake(&rcu_sleepers, MAX_THREADS);
+			unlock();
+		}
+	}
+}
+
+static void rcu_quiescent_state(){
+	if(TID != NO_THREAD && TCB_Table[TID].rcu_nesting == 0){
+		__atomic_store_n(&TCB_Table[TID].rcu_qs_seq, __atomic_load_n(&rcu_gp_seq, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	}
+}
+
+static bool rcu_quiescent(pthread_t tid, uint64_t target){
+	thread_control_block *TCB = &TCB_Table[tid];
+	if(tid == TID || TCB->status == TS_EMPTY || TCB->status == TS_EXITED || TCB->status == TS_FIBER){
+		return true;
+	}
+	if(__atomic_load_n(&TCB->rcu_qs_seq, __ATOMIC_ACQUIRE) >= target){
+		return true;
+	}
+
+	// A thread that was switched out outside a critical section holds no references. A running
+	// one on another worker may have just entered one, so it has to report for itself
+	return TCB->status != TS_RUNNING && TCB->rcu_nesting == 0;
+}
+
+static void rcu_kick(){
+	siginfo_t info;
+	memset(&info, 0, sizeof(info));
+	info.si_signo = SIGALRM;
+	info.si_code = SI_QUEUE;
+	info.si_pid = getpid();
+	info.si_uid = getuid();
+	info.si_value.sival_int = RCU_KICK_ID;
+	for(int i = 0; i < worker_count; i++){
+		if(i != current_worker && Workers[i].started){
+			syscall(SYS_rt_tgsigqueueinfo, getpid(), Workers[i].ktid, SIGALRM, &info);
+		}
+	}
+}
+
+void synchronize_rcu(void){
+	lock();
+	// Callbacks queued before the grace period starts are safe to run once it ends
+	struct rcu_head *batch = rcu_pending;
+	uint64_t ticket = (batch != NULL) ? ++rcu_batches_taken : 0;
+	rcu_pending = NULL;
+	rcu_pending_count = 0;
+	uint64_t target = __atomic_add_fetch(&rcu_gp_seq, 1, __ATOMIC_SEQ_CST);
+	while(1){
+		bool waiting = false;
+		bool running = false;
+		for(pthread_t tid = 0; tid < MAX_THREADS; tid++){
+			if(!rcu_quiescent(tid, target)){
+				waiting = true;
+				running |= (TCB_Table[tid].status == TS_RUNNING);
+			}
+		}
+		if(!waiting){
+			break;
+		}
+
+		// Readers running on other workers may not be switched out for a long time, so ask their
+		// workers now and look again on the next tick. A signal handler cannot wake us up
+		if(running){
+			rcu_kick();
+			TCB_Table[TID].block_reason = BLOCK_SYNC;
+			timer_block(timer_after(TIMER_TICK_USECS));
+			continue;
+		}
+
+		// The others were switched out inside a critical section, and wake us up once they leave it.
+		// They cannot run before futex_wait() has queued us, since that needs lock() too
+		__atomic_add_fetch(&rcu_sleepers, 1, __ATOMIC_SEQ_CST);
+		futex_wait(&rcu_sleepers);
+		__atomic_sub_fetch(&rcu_sleepers, 1, __ATOMIC_SEQ_CST);
+	}
+	unlock();
+
+	if(batch != NULL){
+		rcu_run(batch);
+		rcu_batch_done(ticket);
+	}
+}
+
+static void rcu_batch_done(uint64_t ticket){
+	// A batch only counts as done once every batch taken before it is, so that rcu_barrier()
+	// can wait for a single number
+	lock();
+	while(rcu_batches_done != ticket - 1){
+		futex_wait(&rcu_batches_done);
+	}
+	rcu_batches_done = ticket;
+	futex_wake(&rcu_batches_done, MAX_THREADS);
+	unlock();
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head)){
+	head->func = func;
+
+	lock();
+	head->next = rcu_pending;
+	rcu_pending = head;
+	bool full = (++rcu_pending_count >= RCU_BATCH);
+	if(!rcu_exit_flush){
+		rcu_exit_flush = true;
+		atexit(&rcu_barrier);
+	}
+	unlock();
+
+	// One grace period covers the whole batch
+	if(full){
+		rcu_barrier();
+	}
+}
+
+void rcu_barrier(void){
+	lock();
+	bool queued = (rcu_pending != NULL);
+	uint64_t target = rcu_batches_taken;
+	unlock();
+	if(queued){
+		synchronize_rcu();
+	}
+
+	// Other threads may have taken callbacks queued before we were called off rcu_pending,
+	// and still be waiting for their grace period or running them
+	lock();
+	while(rcu_batches_done < target){
+		futex_wait(&rcu_batches_done);
+	}
+	unlock();
+}
+
+static void rcu_run(struct rcu_head *batch){
+	// Run the callbacks in the order they were queued
+	struct rcu_head *ordered = NULL;
+	while(batch != NULL){
+		struct rcu_head *next = batch->next;
+		batch->next = ordered;
+		ordered = batch;
+		batch = next;
+	}
+	while(ordered != NULL){
+		struct rcu_head *next = ordered->next;
+		ordered->func(ordered);
+		ordered = next;
+	}
+}
+
+//***************************************Channels***************************************//
+
+chan_t *chan_create(size_t capacity, size_t elem_size){
+	if(elem_size == 0){
+		errno = EINVAL;
+		return NULL;
+	}
+
+	chan_t *chan = malloc(sizeof(chan_t) + capacity * elem_size);
+	if(chan == NULL){
+		errno = ENOMEM;
+		return NULL;
+	}
+	chan->capacity = capacity;
+	chan->elem_size = elem_size;
+	chan->head = 0;
+	chan->count = 0;
+	chan->closed = false;
+	chan->senders.head = chan->senders.tail = NULL;
+	chan->receivers.head = chan->receivers.tail = NULL;
+	return chan;
+}
+
+int chan_destroy(chan_t *chan){
+	lock();
+	if(chan_waiting(&chan->senders) || chan_waiting(&chan->receivers)){
+		unlock();
+		return EBUSY;
+	}
+	unlock();
+	free(chan);
+	return 0;
+}
+
+int chan_send(chan_t *chan, const void *elem){
+	chan_case_t c = {chan, true, (void *) elem, 0};
+	chan_select(&c, 1, true);
+	return c.result;
+}
+
+int chan_recv(chan_t *chan, void *elem){
+	chan_case_t c = {chan, false, elem, 0};
+	chan_select(&c, 1, true);
+	return c.result;
+}
+
+int chan_close(chan_t *chan){
+	lock();
+	if(chan->closed){
+		unlock();
+		return EPIPE;
+	}
+	chan->closed = true;
+
+	// Blocked receivers found the buffer empty, and blocked senders can no longer send
+	chan_waiter *waiter;
+	while((waiter = chan_dequeue(&chan->receivers)) != NULL){
+		chan_fire(waiter, EPIPE);
+	}
+	while((waiter = chan_dequeue(&chan->senders)) != NULL){
+		chan_fire(waiter, EPIPE);
+	}
+	unlock();
+	return 0;
+}
+
+int chan_select(chan_case_t *cases, size_t n, bool block){
+	lock();
+	bool any = false;
+	for(size_t i = 0; i < n; i++){
+		if(cases[i].chan == NULL){
+			continue;
+		}
+		any = true;
+		int result = chan_try(&cases[i]);
+		if(result != EAGAIN){
+			cases[i].result = result;
+			unlock();
+			return i;
+		}
+	}
+	if(!block || !any){
+		unlock();
+		return -1;
+	}
+
+	// Queue up on every channel. Whoever goes ahead with one of the cases copies the element
+	// straight to or from this stack, and picks the case before waking the thread up
+	chan_wait wait = {-1, 0};
+	chan_waiter waiters[n];
+	for(size_t i = 0; i < n; i++){
+		if(cases[i].chan == NULL){
+			continue;
+		}
+		waiters[i].tid = TID;
+		waiters[i].elem = cases[i].elem;
+		waiters[i].index = i;
+		waiters[i].wait = &wait;
+		chan_enqueue(cases[i].send ? &cases[i].chan->senders : &cases[i].chan->receivers, &waiters[i]);
+	}
+	TCB_Table[TID].block_reason = BLOCK_SYNC;
+	while(wait.selected == -1){
+		set_status(TID, TS_BLOCKED);
+		context_switch();
+	}
+
+	// The other waiters must not outlive this stack frame
+	for(size_t i = 0; i < n; i++){
+		if(cases[i].chan != NULL && (int) i != wait.selected){
+			chan_remove(cases[i].send ? &cases[i].chan->senders : &cases[i].chan->receivers, &waiters[i]);
+		}
+	}
+	cases[wait.selected].result = wait.result;
+	unlock();
+	return wait.selected;
+}
+
+static int chan_try(chan_case_t *c){
+	chan_t *chan = c->chan;
+	chan_waiter *peer;
+
+	if(c->send){
+		if(chan->closed){
+			return EPIPE;
+		}
+
+		// A waiting receiver means the buffer is empty, so the element goes straight to it
+		if((peer = chan_dequeue(&chan->receivers)) != NULL){
+			memcpy(peer->elem, c->elem, chan->elem_size);
+			chan_fire(peer, 0);
+			return 0;
+		}
+		if(chan->count < chan->capacity){
+			memcpy(chan->buffer + (chan->head + chan->count) % chan->capacity * chan->elem_size, c->elem, chan->elem_size);
+			chan->count++;
+			return 0;
+		}
+		return EAGAIN;
+	}
+
+	if(chan->count > 0){
+		memcpy(c->elem, chan->buffer + chan->head * chan->elem_size, chan->elem_size);
+		chan->head = (chan->head + 1) % chan->capacity;
+		chan->count--;
+
+		// The slot that just freed up goes to the first waiting sender
+		if((peer = chan_dequeue(&chan->senders)) != NULL){
+			memcpy(chan->buffer + (chan->head + chan->count) % chan->capacity * chan->elem_size, peer->elem, chan->elem_size);
+			chan->count++;
+			chan_fire(peer, 0);
+		}
+		return 0;
+	}
+
+	// An empty buffer with a waiting sender, always the case without a buffer
+	if((peer = chan_dequeue(&chan->senders)) != NULL){
+		memcpy(c->elem, peer->elem, chan->elem_size);
+		chan_fire(peer, 0);
+		return 0;
+	}
+	return chan->closed ? EPIPE : EAGAIN;
+}
+
+static void chan_enqueue(chan_queue *queue, chan_waiter *waiter){
+	waiter->next = NULL;
+	if(queue->head == NULL){
+		queue->head = waiter;
+	}
+	else{
+		queue->tail->next = waiter;
+	}
+	queue->tail = waiter;
+}
+
+static chan_waiter *chan_dequeue(chan_queue *queue){
+	chan_waiter *waiter;
+	while((waiter = queue->head) != NULL){
+		queue->head = waiter->next;
+		if(queue->head == NULL){
+			queue->tail = NULL;
+		}
+		if(waiter->wait->selected == -1){
+			return waiter;
+		}
+	}
+	return NULL;
+}
+
+static bool chan_waiting(chan_queue *queue){
+	for(chan_waiter *node = queue->head; node != NULL; node = node->next){
+		if(node->wait->selected == -1){
+			return true;
+		}
+	}
+	return false;
+}
+
+static void chan_remove(chan_queue *queue, chan_waiter *waiter){
+	chan_waiter *prev = NULL;
+	for(chan_waiter *node = queue->head; node != NULL; prev = node, node = node->next){
+		if(node == waiter){
+			if(prev == NULL){
+				queue->head = node->next;
+			}
+			else{
+				prev->next = node->next;
+			}
+			if(queue->tail == node){
+				queue->tail = prev;
+			}
+			return;
+		}
+	}
+}
+
+static void chan_fire(chan_waiter *waiter, int result){
+	waiter->wait->selected = waiter->index;
+	waiter->wait->result = result;
+	set_status(waiter->tid, TS_READY);
+}